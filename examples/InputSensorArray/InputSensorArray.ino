@@ -18,6 +18,22 @@
 // e.g. s.tdi[0], s.tdi[1] etc
 InputSensorArray s;
 
+// Called by readHistory() for each record of the history
+void printHistory(const TdioHistoryEntry *entry) {
+
+  Serial.print(F("    Block "));
+  Serial.print(entry->eepromBlock);
+  Serial.print(F(" "));
+  Serial.print(entry->year);
+  Serial.print(F("-"));
+  print2Digits(entry->month);
+  Serial.print(F(": "));
+  Serial.print(entry->onDuration);
+  Serial.print(F(" ms, "));
+  Serial.print(entry->energy);
+  Serial.println(F(" Wh"));
+}
+
 void setup()  {
   
   Serial.begin(9600);
@@ -31,27 +47,43 @@ void setup()  {
   setSyncProvider(RTC.get);   // the function to sync the time from the RTC  
   setSyncInterval(300); // set the number of seconds between re-sync of the RTC
 
-  // Creates a sensor named "Pump" using tdi[0], which reads arduino digital pin 8, is active-ON, 
-  // pinMode is INPUT and uses EEPROM memory block 0 
-  s.tdi[0].begin("Pump", 8, TDIO_LOGIC_POSITIVE, false, 0);
+  // Configures all sensors at once. Each line of the table has the arguments 
+  // of TimedDigitalInput::begin(): name, pin, logic, pullup and EEPROM block.
+  // e.g. "Pump" uses tdi[0], reads arduino digital pin 8, is active-ON, 
+  // pinMode is INPUT and uses EEPROM memory block 0.
+  // After a power failure, counting continues from the last checkpoint,
+  // including today's counters
+  static const TdiDescriptor sensors[] = {
+    {"Pump",   8,  TDIO_LOGIC_POSITIVE, false, 0},
+    {"Heater", 9,  TDIO_LOGIC_POSITIVE, false, 1},
+    {"Boiler", 10, TDIO_LOGIC_POSITIVE, false, 2},
+    {"Lamp",   11, TDIO_LOGIC_POSITIVE, false, 3}
+  };
+  s.begin(sensors, 4);
+
+  Serial.print(F("Sensors ready in "));
+  Serial.print(s.coldStartMicros);
+  Serial.println(F(" micros"));
 
-
-  // Creates a sensor named "Heater"  using tdi[1], which reads arduino digital pin 9, is active-ON, 
-  // pinMode is INPUT and uses EEPROM memory block 1   
-  s.tdi[1].begin("Heater", 9, TDIO_LOGIC_POSITIVE, false, 1);
   // Set the EEPROM recording interval in seconds
   // Deliberately setting a value lower than EEPROM_MINIMUM_RECORDING_INTERVAL
   // to show the fail-safe
   s.tdi[1].setEEPROMRecordingInterval(20);
 
-  // Two more sensors
-  s.tdi[2].begin("Boiler", 10, TDIO_LOGIC_POSITIVE, false, 2);
-  s.tdi[3].begin("Lamp", 11, TDIO_LOGIC_POSITIVE, false, 3); 
+  // The heater is rated at 2 kW. Its energy is counted in todayEnergy and currentMonthEnergy
+  s.tdi[1].ratedPower = 2000;
+
+  // The lamp changes rarely, so it is read once a second instead of on every loop
+  s.tdi[3].setPriority(TDIO_PRIORITY_SLOW);
 
   // Presents what has been recorded so far in the EEPROM for memory blocks 0 and 1
   s.printMonthlyActivity(0);
   s.printMonthlyActivity(1);  
 
+  // The history keeps the monthly durations of all sensors for several years
+  Serial.println(F("------ HISTORY -------------------"));
+  s.readHistory(printHistory);
+
   Serial.print(F("Time now is "));
   printHumanTime(now());
   Serial.println();
@@ -66,11 +98,10 @@ void loop() {
   // do it as per the example below which prints sensor data every 5 seconds.
 
   static uint32_t previousMillis;
+  static uint32_t previousCheckpointMillis;
   
-  s.tdi[0].readSensor(); 
-  s.tdi[1].readSensor();
-  s.tdi[2].readSensor();
-  s.tdi[3].readSensor();
+  // Reads all the sensors registered by begin() 
+  s.readSensors();
 
   // Report current status every so often.
   // Not too fast to allow quick reading of 
@@ -82,8 +113,22 @@ void loop() {
     s.printSensorData(&s.tdi[1]);
     //s.printSensorData(&s.tdi[2]);
     //s.printSensorData(&s.tdi[3]);
+    // Longest gap between two samples of a sensor. If late samples are
+    // reported, the loop is too slow for the sensors
+    Serial.print(F("Longest sample interval: "));
+    Serial.print(s.longestSampleInterval);
+    Serial.print(F(" ms, late samples: "));
+    Serial.print(s.lateSamples);
+    Serial.print(F(", possible missed pulses: "));
+    Serial.println(s.possibleMissedPulses);
     
   }
+
+  // Save the counters of all sensors every hour
+  if (millis() - previousCheckpointMillis > 3600000UL) {
+    previousCheckpointMillis = millis();
+    s.saveCheckpoint();
+  }
     
 }
 
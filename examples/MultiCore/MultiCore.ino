@@ -0,0 +1,115 @@
+/*
+  TimedDigitalIO - Library for timing Digital inputs and Outputs.
+
+  Example sketch for dual core boards, ESP32 and RP2040.
+  
+  The pins are sampled every millisecond on one core, by captureSensors().
+  Everything else (durations, EEPROM, history, printing) runs in loop() on the 
+  other core, by accountSensors(). A slow loop() never delays a sample, and
+  nothing that happened in the meantime is lost.
+
+  On the ESP32 the sampler is a FreeRTOS task pinned to core 0, as loop() runs on core 1.
+  On the RP2040 (Arduino-Pico core) the sampler runs in loop1() on the second core.
+  Both boards emulate the EEPROM in flash, which is written by EEPROM.commit().
+*/
+#include <TimeLib.h>
+#include <Wire.h>
+#include <DS1307RTC.h>
+
+// Our library
+#include "TimedDigitalIO.h"
+
+#if !TDIO_SAMPLER
+  #error "This example needs an ESP32 or RP2040 board, or -DTDIO_SAMPLER=1"
+#endif
+
+// Size of the emulated EEPROM. It must hold the monthly blocks, the checkpoints and the history
+#define EEPROM_SIZE 4096
+
+// Sampling period in millis
+#define SAMPLE_PERIOD 1
+
+InputSensorArray s;
+
+#if defined(ARDUINO_ARCH_ESP32)
+//--------------------------------------------------------
+// Sampler task at a fixed rate. Its priority is above loop(), so that
+// it can also run on a single core ESP32
+void samplerTask(void *parameter) {
+
+  TickType_t lastWake = xTaskGetTickCount();
+  for (;;) {
+    s.captureSensors();
+    vTaskDelayUntil(&lastWake, pdMS_TO_TICKS(SAMPLE_PERIOD));
+  }
+}
+#endif
+
+void setup()  {
+
+  Serial.begin(115200);
+  while (!Serial) {
+    ; // wait for serial port to connect. Needed for native USB port only
+  }
+
+  Serial.println(F("****** Timed Digital Input Multi Core Example *******"));
+
+  EEPROM.begin(EEPROM_SIZE);
+
+  setSyncProvider(RTC.get);   // the function to sync the time from the RTC  
+  setSyncInterval(300); // set the number of seconds between re-sync of the RTC
+
+  // Register all sensors before the sampler starts
+  static const TdiDescriptor sensors[] = {
+    {"Pump",   16, TDIO_LOGIC_POSITIVE, false, 0},
+    {"Heater", 17, TDIO_LOGIC_POSITIVE, false, 1},
+    {"Boiler", 18, TDIO_LOGIC_POSITIVE, false, 2},
+    {"Lamp",   19, TDIO_LOGIC_POSITIVE, false, 3}
+  };
+  s.begin(sensors, 4);
+  s.tdi[1].ratedPower = 2000;
+
+  #if defined(ARDUINO_ARCH_ESP32)
+    xTaskCreatePinnedToCore(samplerTask, "sampler", 2048, NULL, 2, NULL, 0);
+  #endif
+
+}
+
+#if defined(ARDUINO_ARCH_RP2040)
+//--------------------------------------------------------
+// Second core of the RP2040. Runs the sampler at a fixed rate
+void loop1() {
+
+  static uint32_t previousMillis;
+  
+  if (millis() - previousMillis >= SAMPLE_PERIOD) {
+    previousMillis += SAMPLE_PERIOD;
+    s.captureSensors();
+  }
+}
+#endif
+
+void loop() {
+
+  static uint32_t previousMillis;
+  static uint32_t previousCheckpointMillis;
+
+  // Adds what the sampler measured since the previous call
+  s.accountSensors();
+
+  if (millis() - previousMillis > 5000) {
+    previousMillis = millis();
+    for (uint16_t n = 0; n < s.count(); n++)
+      s.printSensorData(s.sensor(n));
+  }
+
+  // Save the counters of all sensors every hour, and write the emulated EEPROM to flash
+  if (millis() - previousCheckpointMillis > 3600000UL) {
+    previousCheckpointMillis = millis();
+    s.saveCheckpoint();
+    EEPROM.commit();
+  }
+
+  // A slow loop() does not delay the samples
+  delay(100);
+}
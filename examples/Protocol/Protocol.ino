@@ -0,0 +1,69 @@
+/*
+  TimedDigitalIO - Library for timing Digital inputs and Outputs.
+
+ * Example of the binary request/response protocol, for a remote collector 
+ * (e.g. SCADA) that reads the sensors and sets the outputs over RS-485.
+ * 
+ * The frame format and the commands are described in TimedDigitalIO.h, class TdioProtocol.
+ * Debug printouts share the serial port with the protocol, so set TDIO_DEBUG 0.
+*/
+// Use the Time library for time manipulation (numer to time and vice versa)
+#include <TimeLib.h>
+// Use the Wire library to communicate with RTC via I2C
+#include <Wire.h>
+// The library for the RealTimeClock
+#include <DS1307RTC.h>  // a basic DS1307 library that returns time as a time_t
+
+// Our library
+#include "TimedDigitalIO.h"
+
+// Address of this device on the bus
+#define DEVICE_ADDRESS 1
+
+// Pin driving DE/RE of the RS-485 transceiver. 
+// Use TDIO_PROTOCOL_NO_PIN for transceivers with automatic direction control
+#define TX_ENABLE_PIN 2
+
+// A 56 byte reply takes 5 millis at 115200 baud
+#define BAUD 115200
+
+InputSensorArray in;
+OutputSensorArray out;
+TdioProtocol protocol;
+
+void setup()  {
+  
+  Serial.begin(BAUD);
+   
+  setSyncProvider(RTC.get);   // the function to sync the time from the RTC  
+  setSyncInterval(300); // set the number of seconds between re-sync of the RTC
+
+  static const TdiDescriptor sensors[] = {
+    {"Pump",   8,  TDIO_LOGIC_POSITIVE, false, 0},
+    {"Heater", 9,  TDIO_LOGIC_POSITIVE, false, 1}
+  };
+  in.begin(sensors, 2);
+
+  out.add("Valve", 4, TDIO_LOGIC_POSITIVE);
+
+  // The baud rate tells how long the transmitter stays enabled after a reply
+  protocol.begin(Serial, DEVICE_ADDRESS, &in, &out, TX_ENABLE_PIN, BAUD);
+  
+}
+
+void loop() {
+
+  static uint32_t previousCheckpointMillis;
+
+  in.readSensors();
+  out.checkTimers();
+
+  // Answers the requests that have arrived, without waiting for more bytes
+  protocol.poll();
+
+  if (millis() - previousCheckpointMillis > 3600000UL) {
+    previousCheckpointMillis = millis();
+    in.saveCheckpoint();
+  }
+    
+}
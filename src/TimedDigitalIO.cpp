@@ -34,10 +34,38 @@
 #include "Arduino.h"
 #include "TimedDigitalIO.h"
 
+// The monthly blocks, the checkpoint journal and the history must fit in the EEPROM of the board.
+// The AVR drops the upper address bits, so a write past E2END would overwrite the monthly blocks.
+// The layout depends on sizeof(), which #if cannot evaluate
+#ifdef E2END
+  #if TDIO_HISTORY
+    static_assert(TDIO_HISTORY_OFFSET + TDIO_HISTORY_SIZE <= E2END + 1, 
+                  "The history does not fit in the EEPROM. Reduce TDI_MAX_SENSORS or TDIO_HISTORY_SIZE, or set TDIO_HISTORY 0");
+  #else
+    static_assert(TDIO_CHECKPOINT_OFFSET + 2 * (sizeof(TdioCheckpointHeader) + TDI_MAX_SENSORS * sizeof(TdioCheckpointRecord)) <= E2END + 1, 
+                  "The checkpoint journal does not fit in the EEPROM. Reduce TDI_MAX_SENSORS");
+  #endif
+#endif
+
+#if TDIO_STATS
+TdioStats tdioStats;
+#endif
+
+uint16_t TimedDigitalInput::_startedCount = 0;
+
 // Class constructor
 TimedDigitalInput::TimedDigitalInput() {
 }
 
+//--------------------------------------------------------
+// Millis from the start of the month of a time to that time. No duration of the month can be longer.
+// A monthly value above it is left over from the same month of a previous year, 
+// or was torn by a power failure while it was being written
+static uint32_t monthElapsedMillis(time_t t) {
+
+  return (((uint32_t)(day(t) - 1) * 24 + hour(t)) * 3600UL + minute(t) * 60UL + second(t)) * 1000UL;
+}
+
 /*
   Must be called for each sensor 
     name: The name of the sensor, at it will appear on printouts, e.g. "Heater"
@@ -48,12 +76,34 @@ TimedDigitalInput::TimedDigitalInput() {
 */
 int TimedDigitalInput::begin(const char *name, uint8_t pinCode, uint8_t logic, boolean pullup, uint8_t eepromBlock) {
 
-  // Check pin validity. 
-  if (pinValid(pinCode))
-     sensorPin = pinCode;
-    //setSensorPin(pinCode);
-  else
+  if (configure(name, pinCode, logic, pullup, eepromBlock) != 0)
+    return -1;
+
+  _timeNow = now();
+
+  // Month where time is counted. Months are 1-12
+  // If something is stored in EEPROM for the current month, 
+  // it means that we had a power outage, and we are restarting.
+  // Since we have had recordings for that month
+  // we will add to that.
+  uint8_t thisMonth = month(_timeNow);
+  uint32_t monthOnDuration = readEEPROM(thisMonth);
+  if (monthOnDuration > monthElapsedMillis(_timeNow))
+    monthOnDuration = monthElapsedMillis(_timeNow);
+  initCounters(thisMonth, day(_timeNow), monthOnDuration);
+  ++_startedCount;
+
+  return 0;
+}
+
+//--------------------------------------------------------
+// Checks and sets the configuration of the sensor and the mode of its pin
+int TimedDigitalInput::configure(const char *name, uint8_t pinCode, uint8_t logic, boolean pullup, uint8_t eepromBlock) {
+
+  if (!configValid(pinCode, eepromBlock))
     return -1;
+
+  sensorPin = pinCode;
       
   if (pullup)
     pinMode(sensorPin, INPUT_PULLUP);
@@ -69,8 +119,6 @@ int TimedDigitalInput::begin(const char *name, uint8_t pinCode, uint8_t logic, b
     sensorLogic = TDIO_LOGIC_POSITIVE;
   else
     sensorLogic = TDIO_LOGIC_NEGATIVE;
-  
-  //setSensorLogic(logic);
 
   /*
     Set the EEPROM block where monthly data are written.
@@ -78,10 +126,7 @@ int TimedDigitalInput::begin(const char *name, uint8_t pinCode, uint8_t logic, b
     This value defines which 48 byte block will be used to
     read past data and write new data every month.
   */
-  if ((eepromBlock >= 0) && (eepromBlock < TDI_MAX_SENSORS))
-    EEPROMBlock = eepromBlock;
-  else
-    return -1;
+  EEPROMBlock = eepromBlock;
 
   /*
     Set the sensor name
@@ -89,6 +134,22 @@ int TimedDigitalInput::begin(const char *name, uint8_t pinCode, uint8_t logic, b
   strncpy(sensorName, name, sizeof(sensorName) -1); 
   sensorName[sizeof(sensorName)-1] = NULL;
 
+  return 0;
+}
+
+//--------------------------------------------------------
+// True if configure() accepts the pin and the EEPROM block. Changes nothing
+boolean TimedDigitalInput::configValid(uint8_t pinCode, uint8_t eepromBlock) {
+
+  return pinValid(pinCode) && eepromBlock < TDI_MAX_SENSORS;
+}
+
+//--------------------------------------------------------
+// Sets the initial values of the counters. The calendar state and the recorded 
+// duration of the current month are given by the caller, so that an array 
+// of sensors can compute them once for all sensors
+void TimedDigitalInput::initCounters(uint8_t thisMonth, uint8_t today, uint32_t monthOnDuration) {
+
   /*
     Set initial values for class variables
   */ 
@@ -97,21 +158,19 @@ int TimedDigitalInput::begin(const char *name, uint8_t pinCode, uint8_t logic, b
   _previousState = TDIO_STATE_OFF;
   _previousMillis = 0;   
 
-  _timeNow = now();
-
-  // Month where time is counted. Months are 1-12
-   currentMonth = month(_timeNow);
-  // If something is stored in EEPROM for the current month, 
-  // it means that we had a power outage, and we are restarting.
-  // Since we have had recordings for that month
-  // we will add to that.
-  currentMonthOnDuration = readEEPROM(currentMonth);
-  
-  currentDay = day(_timeNow);  
+  // Month and day where time is counted. Months are 1-12
+  currentMonth = thisMonth;
+  currentMonthOnDuration = monthOnDuration;
+  currentDay = today;
 
   // Number of times the sensor came ON today and duration
   todayOnCounter = 0;
   todayOnDuration = 0;
+
+  // Energy of today and of the current month, in Wh
+  todayEnergy = 0;
+  currentMonthEnergy = 0;
+  _energyRemainder = 0;
   
   // Time that the sensor reported as on during the previous OFF - ON - OFF sequence
   previousOnDuration = 0;
@@ -130,7 +189,16 @@ int TimedDigitalInput::begin(const char *name, uint8_t pinCode, uint8_t logic, b
   
   // Last time when we wrote data to EEPROM
   _previousEEPROMWriteMillis = 0;
+  _pendingStores = 0;
+
+  // No sample yet, so the first one is due at once and has no interval, see InputSensorArray::sampleSensor().
+  // A slot reused by add() starts with clean sampling measurements
+  _lastSampleMillis = 0;
+  _lastChangeMillis = 0;
+  lateSamples = 0;
+  possibleMissedPulses = 0;
 
+  _active = true;
 
 }
 
@@ -138,7 +206,22 @@ int TimedDigitalInput::begin(const char *name, uint8_t pinCode, uint8_t logic, b
 //--------------------------------------------------------
 void TimedDigitalInput::readSensor(void) {
 
+  sample(false);
+}
+
+//--------------------------------------------------------
+// Reads the pin and updates the counters.
+// If deferStores is true, the EEPROM writes are not performed here but marked as pending,
+// to be performed later by flushPendingStores()
+void TimedDigitalInput::sample(boolean deferStores) {
+
     _timeNow = now();
+    uint32_t currentMillis = millis();
+    // A change happened somewhere since the previous sample. It is taken half way, 
+    // on both edges, so that reduced sampling does not bias the durations.
+    // The first sample after begin() has no previous one
+    uint32_t halfGap = (_lastSampleMillis == 0) ? 0 : (currentMillis - _lastSampleMillis) / 2;
+    _lastSampleMillis = currentMillis;
     
     // Set the new state based on logic and pin value
     setState(digitalRead(sensorPin));
@@ -146,8 +229,9 @@ void TimedDigitalInput::readSensor(void) {
     if (sensorState == TDIO_STATE_ON) {
        
       if (_previousState == TDIO_STATE_OFF) {
-        // Sensor is activated. Start counting time
+        // Sensor is activated. Start counting time, from half way since the previous sample
         toggleStateOn();
+        addOnDuration(halfGap);
         
       } else {
         // System was already active, continue timing       
@@ -158,8 +242,8 @@ void TimedDigitalInput::readSensor(void) {
     } else { // state == TDIO_STATE_OFF
 
       if (_previousState == TDIO_STATE_ON) {
-        // System is stopped
-        recordUpToNow(); 
+        // System is stopped, half way since the previous sample
+        recordUpTo(currentMillis - halfGap); 
         // Stop timing
         toggleStateOff();
         
@@ -169,18 +253,66 @@ void TimedDigitalInput::readSensor(void) {
       }          
   }
 
+  updateCalendar(deferStores);
+}
+
+#if TDIO_SAMPLER
+//--------------------------------------------------------
+// Updates the counters from the measurements of a sampler, see InputSensorArray::captureSensors().
+// state is the state at the last capture, onMillis the ON time and onEdges the number of 
+// times the sensor came ON since the previous call.
+// The totals are exact. Pulses that started and ended between two calls are counted,
+// but their durations are merged in previousOnDuration
+void TimedDigitalInput::account(uint8_t state, uint32_t onMillis, uint32_t onEdges, boolean deferStores) {
+
+  _timeNow = now();
+  _lastSampleMillis = millis();
+  sensorState = state;
+  addOnDuration(onMillis);
+
+  // The ON period in progress ended, at the latest when the sensor came ON again
+  if (_previousState == TDIO_STATE_ON && (onEdges > 0 || state == TDIO_STATE_OFF))
+    toggleStateOff();
+
+  if (state == TDIO_STATE_ON && _previousState == TDIO_STATE_OFF) {
+    toggleStateOn();
+    if (onEdges > 0)
+      --onEdges;
+  }
+  // Whole pulses between the two calls
+  todayOnCounter += onEdges;
+
+  updateCalendar(deferStores);
+}
+#endif
+
+//--------------------------------------------------------
+// Periodic EEPROM write, and day and month change, after each sample
+void TimedDigitalInput::updateCalendar(boolean deferStores) {
+
   // Is it time to record current data to EEPROM?
   // We may write twice, immediately after or before the month crossing. I guess we cannot avoid it.
   uint32_t currentMillis = millis();
   if ( currentMillis - _previousEEPROMWriteMillis >= _EEPROMRecordingInterval) {  
-    storeEEPROM(currentMonth, currentMonthOnDuration);
+    if (deferStores)
+      _pendingStores |= TDIO_PENDING_CURRENT;
+    else
+      storeEEPROM(currentMonth, currentMonthOnDuration);
     _previousEEPROMWriteMillis = currentMillis;
   }
      
   // Check if we crossed day
   if (day(_timeNow) != currentDay) {
+    #if TDIO_HISTORY && TDIO_HISTORY_DAILY
+      // Keep the total of the day that closed until it is logged in the history
+      _closedDay = currentDay;
+      _closedDayMonth = currentMonth;
+      _closedDayOnDuration = todayOnDuration;
+      _pendingStores |= TDIO_PENDING_HISTORY_DAY;
+    #endif
     currentDay = day(_timeNow);
     todayOnDuration = 0;
+    todayEnergy = 0;
     #if TDIO_DEBUG
       Serial.print(F("Day change to "));
       Serial.println(currentDay);
@@ -191,18 +323,30 @@ void TimedDigitalInput::readSensor(void) {
   // Check if we crossed month. 
   if (month(_timeNow) != currentMonth) { 
     
-    storeEEPROM(currentMonth, currentMonthOnDuration); 
+    // Keep the total of the month that closed until it is written
+    _closedMonth = currentMonth;
+    _closedMonthOnDuration = currentMonthOnDuration;
+    _closedMonthEnergy = currentMonthEnergy;
     // Set new current month as per clock 
     currentMonth = month(_timeNow);
     // Start counting the month data from zero
     currentMonthOnDuration = 0;
+    currentMonthEnergy = 0;
      
-    // Prepare next month with a zero value, so that we will be ready to add time
-    // after the month crossing
-    uint8_t nextMonth = currentMonth + 1;
-    if (nextMonth > 12)
-      nextMonth = 1;
-    storeEEPROM(nextMonth, 0);
+    // Write the closed month and prepare next month with a zero value, 
+    // so that we will be ready to add time after the month crossing.
+    // A pending write of the current month is replaced by the write of the closed month.
+    if (deferStores) {
+      _pendingStores &= ~TDIO_PENDING_CURRENT;
+      _pendingStores |= TDIO_PENDING_CLOSED | TDIO_PENDING_NEXT;
+    } else {
+      storeEEPROM(_closedMonth, _closedMonthOnDuration); 
+      storeEEPROM(nextMonthOf(currentMonth), 0);
+    }
+    #if TDIO_HISTORY
+      // Logged in the history by the array, which owns the history log
+      _pendingStores |= TDIO_PENDING_HISTORY_MONTH;
+    #endif
 
     #if TDIO_DEBUG
       Serial.print(F("Month change to "));
@@ -213,6 +357,57 @@ void TimedDigitalInput::readSensor(void) {
    
 }
 
+//--------------------------------------------------------
+// True if the sampling period of the sensor has passed since its last sample,
+// or if the sensor changed state recently.
+// A change is known only within the interval between two samples, and sample() 
+// takes it half way, on the ON and on the OFF edge alike. Sampling less often 
+// therefore does not bias the accumulated durations: each activation is off by 
+// up to half a sampling period, in either direction, and the errors average out.
+boolean TimedDigitalInput::sampleDue(uint32_t currentMillis) {
+
+  if (samplePeriod == 0)
+    return true;
+  if (currentMillis - _lastChangeMillis < TDIO_BOOST_DURATION)
+    return true;
+  return currentMillis - _lastSampleMillis >= samplePeriod;
+}
+
+//--------------------------------------------------------
+// Sets the priority class and the sampling period of the class
+void TimedDigitalInput::setPriority(uint8_t priorityClass) {
+
+  priority = priorityClass;
+  if (priorityClass == TDIO_PRIORITY_SLOW)
+    samplePeriod = TDIO_PERIOD_SLOW;
+  else if (priorityClass == TDIO_PRIORITY_NORMAL)
+    samplePeriod = TDIO_PERIOD_NORMAL;
+  else
+    samplePeriod = TDIO_PERIOD_FAST;
+}
+
+//--------------------------------------------------------
+// Performs the EEPROM writes that sample() left pending
+void TimedDigitalInput::flushPendingStores(void) {
+
+  if (_pendingStores & TDIO_PENDING_CLOSED)
+    storeEEPROM(_closedMonth, _closedMonthOnDuration);
+  if (_pendingStores & TDIO_PENDING_NEXT)
+    storeEEPROM(nextMonthOf(currentMonth), 0);
+  if (_pendingStores & TDIO_PENDING_CURRENT)
+    storeEEPROM(currentMonth, currentMonthOnDuration);
+  _pendingStores = 0;
+
+}
+
+//--------------------------------------------------------
+uint8_t TimedDigitalInput::nextMonthOf(uint8_t thisMonth) {
+
+  if (thisMonth >= 12)
+    return 1;
+  return thisMonth + 1;
+}
+
 //--------------------------------------------------------
 void TimedDigitalInput::toggleStateOn(void) {
 
@@ -220,6 +415,7 @@ void TimedDigitalInput::toggleStateOn(void) {
     printStateChangeInfo();
   #endif
   _previousMillis = millis();      
+  _lastChangeMillis = _previousMillis;
   currentOnStartDateTime = _timeNow;
   ++todayOnCounter;
   _previousState = TDIO_STATE_ON;
@@ -232,6 +428,7 @@ void TimedDigitalInput::toggleStateOff(void) {
   #if TDIO_DEBUG
     printStateChangeInfo();
   #endif
+  _lastChangeMillis = millis();
   previousOnDuration = currentOnDuration;
   previousOnStartDateTime = currentOnStartDateTime;
   previousOnStopDateTime = _timeNow;
@@ -254,18 +451,37 @@ void TimedDigitalInput::setState(uint8_t value) {
 //--------------------------------------------------------
 void TimedDigitalInput::recordUpToNow(void) {
 
+  recordUpTo(millis());
+}
+
+//--------------------------------------------------------
+// Adds the ON time from the previous record up to currentMillis
+void TimedDigitalInput::recordUpTo(uint32_t currentMillis) {
+
   uint32_t millisPassed;
-  uint32_t currentMillis;
   
-  currentMillis = millis(); 
   millisPassed = currentMillis - _previousMillis;
+  _previousMillis = currentMillis;
+  addOnDuration(millisPassed);
+}
+
+//--------------------------------------------------------
+// Adds ON time to the durations and the energy
+void TimedDigitalInput::addOnDuration(uint32_t millisPassed) {
+
   currentOnDuration += millisPassed;
   todayOnDuration += millisPassed;
-  _previousMillis = currentMillis;
   // Register up to now to previous month
   // Depending on the loop period, this may mean that we may have 
   // a monthly on duration larger than the monthly millis              
   currentMonthOnDuration += millisPassed;
+
+  // Energy consumed by the device during the same time, in integer arithmetic
+  if (ratedPower > 0) {
+    uint32_t energy = tdioEnergy(millisPassed, ratedPower, &_energyRemainder);
+    todayEnergy += energy;
+    currentMonthEnergy += energy;
+  }
   
 }
 
@@ -286,8 +502,14 @@ void TimedDigitalInput::storeEEPROM(uint8_t month, uint32_t value) {
   uint32_t written_value;
   // Save EEPROM life. If value to be written is same as the already existing, do not perform a write operation
   EEPROM.get( EEPROM_OFFSET + (EEPROMBlock * 12 + (month - 1) )* sizeof(uint32_t), written_value); 
+  #if TDIO_STATS
+    ++tdioStats.eepromReads;
+  #endif
   if (written_value != value) {
     EEPROM.put( EEPROM_OFFSET + (EEPROMBlock * 12 + (month - 1)) * sizeof(uint32_t),  value);
+    #if TDIO_STATS
+      ++tdioStats.eepromWrites;
+    #endif
     #if TDIO_DEBUG
       Serial.print(F(" #*#*#* Physical write #*#*#*"));
     #endif
@@ -303,6 +525,12 @@ uint32_t TimedDigitalInput::readEEPROM(uint8_t month) {
   uint32_t written_value;
  
   EEPROM.get( EEPROM_OFFSET + (EEPROMBlock * 12 + (month - 1)) * sizeof(uint32_t), written_value);
+  #if TDIO_STATS
+    ++tdioStats.eepromReads;
+  #endif
+  // A factory-fresh EEPROM has never recorded anything for this month
+  if (written_value == EEPROM_ERASED_VALUE)
+    written_value = 0;
   return written_value;
   
 }
@@ -316,6 +544,27 @@ void TimedDigitalInput::setEEPROMRecordingInterval(uint32_t interval) {
   
 }
 
+//--------------------------------------------------------
+// Clears the counters of the current day and month, also in EEPROM.
+// If deferStores is true, the EEPROM write is left pending, for the array to perform
+// when it next samples the sensor. A running activation continues to be timed
+void TimedDigitalInput::resetCounters(boolean deferStores) {
+
+  todayOnCounter = 0;
+  todayOnDuration = 0;
+  currentMonthOnDuration = 0;
+  todayEnergy = 0;
+  currentMonthEnergy = 0;
+  previousOnDuration = 0;
+  previousOnStartDateTime = 0;
+  previousOnStopDateTime = 0;
+  if (deferStores)
+    _pendingStores |= TDIO_PENDING_CURRENT;
+  else
+    storeEEPROM(currentMonth, 0);
+  
+}
+
 //--------------------------------------------------------
 void TimedDigitalInput::printStateChangeInfo(void) {
 
@@ -397,6 +646,13 @@ static void InputSensorArray::printSensorData(TimedDigitalInput *s) {
 
     Serial.print(F("Current month ON duration: "));
     Serial.println(s->currentMonthOnDuration);
+
+    if (s->ratedPower > 0) {
+      Serial.print(F("Today energy Wh: "));
+      Serial.println(s->todayEnergy);
+      Serial.print(F("Current month energy Wh: "));
+      Serial.println(s->currentMonthEnergy);
+    }
     Serial.println(F("------------------------------"));
     Serial.println();
   
@@ -414,6 +670,8 @@ static void InputSensorArray::printMonthlyActivity(uint8_t eepromBlock) {
     for (int i = 1; i <= 12; i++) {
   
       EEPROM.get( EEPROM_OFFSET + (eepromBlock * 12 + (i - 1)) * sizeof(uint32_t), monthly_value);
+      if (monthly_value == EEPROM_ERASED_VALUE)
+        monthly_value = 0;
 
       Serial.print (F("    Month "));
       Serial.print(i);
@@ -426,157 +684,1439 @@ static void InputSensorArray::printMonthlyActivity(uint8_t eepromBlock) {
 }
 
 
-////////////  Digital Output ////////////////////////
-
-// Class constructor
-TimedDigitalOutput::TimedDigitalOutput() {
-}
-
+//--------------------------------------------------------
 /*
-  Must be called for each sensor 
-    name: The name of the sensor, at it will appear on printouts, e.g. "Heater"
-    pinCode: The Arduino pin that is associated with the sensor, e.g. 5
-    logic: TDIO_LOGIC_POSITIVE or TDIO_LOGIC_NEGATIVE. Defines if the pin is active HIGH or active LOW
-    pullup: true or false. If true, the pin mode is defined as INPUT_PULLUP, otherwise as INPUT
-    eepromBlock: Defines the 48byte block of EEPROM whwre the monthly data of the sensor will be recorded
+  Configures and registers the first count sensors of the array from a table, 
+  instead of calling begin() for each sensor.
+  The time is read once for all sensors, and the counters are restored from the newest 
+  checkpoint, reading it once. The total of the current month is the larger of the checkpoint
+  record and the monthly block, which is read in the same pass.
+  Sensors without a record of the current month read it from their monthly block.
+  Returns -1 if an entry of the table is invalid, otherwise the number of sensors restored 
+  from the checkpoint (0 if there is no valid checkpoint).
+  The table is checked first: an invalid entry leaves the array as it was.
+  The duration of the call is kept in coldStartMicros.
 */
-int TimedDigitalOutput::begin(const char *name, uint8_t pinCode, uint8_t logic) {
+int InputSensorArray::begin(const TdiDescriptor *table, uint16_t count) {
 
-  // Check pin validity. 
-  if (pinValid(pinCode))
-    sensorPin = pinCode;
-  else
+  uint32_t startMicros = micros();
+
+  if (count > TDI_MAX_SENSORS)
     return -1;
+  for (uint16_t i = 0; i < count; i++)
+    if (!tdi[i].configValid(table[i].pin, table[i].eepromBlock))
+      return -1;
+
+  // The table replaces any sensors registered before. tdi[i] gets entry i of the table
+  _pool.clear();
+  for (uint16_t i = 0; i < TDI_MAX_SENSORS; i++)
+    tdi[i]._active = false;
+  _startedSeen = TimedDigitalInput::_startedCount;
+  _scanPosition = 0;
+  _roundStarted = false;
+
+  for (uint16_t i = 0; i < count; i++) {
+    tdi[i].configure(table[i].name, table[i].pin, table[i].logic, table[i].pullup, table[i].eepromBlock);
+    _pool.allocate();
+  }
 
-  /*
-    Set the logic of the sensor.
-    TDIO_LOGIC_POSITIVE means 1 is ON and 0 is OFF
-    TDIO_LOGIC_NEGATIVE means 0 is ON and 1 is OFF
- */ 
-  if (logic == TDIO_LOGIC_POSITIVE)
-    sensorLogic = TDIO_LOGIC_POSITIVE;
-  else
-    sensorLogic = TDIO_LOGIC_NEGATIVE;
+  time_t timeNow = now();
+  uint8_t thisMonth = month(timeNow);
+  uint8_t today = day(timeNow);
 
-  /*
-    Set the sensor name
-*/  
-  strncpy(sensorName, name, sizeof(sensorName) -1); 
-  sensorName[sizeof(sensorName)-1] = NULL;
+  // The total of the current month is not known until the checkpoint is read. The sensors
+  // without a record of the current month read it from their monthly block afterwards
+  for (uint16_t i = 0; i < count; i++)
+    tdi[i].initCounters(thisMonth, today, EEPROM_ERASED_VALUE);
 
-  /*
-    Set initial values for class variables
-  */ 
-  // Current state can be on or off, regardless of logic
-  sensorState = TDIO_STATE_OFF;
-  intervalMillis = 0;   
-   
-    // Time that the sensor is currently reporting as ON in millis
-  currentOnDuration = 0;
-    
-  // Time in unixtime when the pin started reporting state ON and is still ON
-  currentOnStartDateTime = 0;
+  int restored = loadCheckpoint(true);
+  if (restored < 0)
+    restored = 0;
+
+  for (uint16_t i = 0; i < count; i++)
+    if (tdi[i].currentMonthOnDuration == EEPROM_ERASED_VALUE) {
+      tdi[i].currentMonthOnDuration = tdi[i].readEEPROM(thisMonth);
+      if (tdi[i].currentMonthOnDuration > monthElapsedMillis(timeNow))
+        tdi[i].currentMonthOnDuration = monthElapsedMillis(timeNow);
+    }
 
+  coldStartMicros = micros() - startMicros;
+
+  return restored;
 }
 
+//--------------------------------------------------------
+// Registers a sensor in a free slot of the array and calls its begin().
+// Returns the sensor, or NULL if there is no free slot or begin() fails
+TimedDigitalInput *InputSensorArray::add(const char *name, uint8_t pinCode, uint8_t logic, boolean pullup, uint8_t eepromBlock) {
+
+  adoptStarted();
+  int slot = _pool.peek();
+  if (slot < 0)
+    return NULL;
+  if (tdi[slot].begin(name, pinCode, logic, pullup, eepromBlock) != 0)
+    return NULL;
+  _pool.allocate();
+  ++_startedSeen;
+  return &tdi[slot];
+}
 
 //--------------------------------------------------------
-// If timer is set to a non zero value, the system will turn on 
-// and then off after timer millis
-void TimedDigitalOutput::setOn(uint32_t timer) {
+// Registers the sensors started with their own begin(), e.g. tdi[0].begin(...), 
+// as sketches did before add(). tdi[] is only checked after such a begin()
+void InputSensorArray::adoptStarted(void) {
+
+  if (_startedSeen == TimedDigitalInput::_startedCount)
+    return;
+  _startedSeen = TimedDigitalInput::_startedCount;
+  for (uint16_t i = 0; i < TDI_MAX_SENSORS; i++)
+    if (tdi[i]._active && !_pool.inUse(i))
+      _pool.allocate(i);
+}
 
-  _timeNow = now();
+//--------------------------------------------------------
+// Unregisters a sensor added with add() or begin(). 
+// The current month is written to EEPROM, so that no time is lost
+int InputSensorArray::remove(TimedDigitalInput *s) {
 
-  setPin(TDIO_STATE_ON);
- 
-  _startMillis = millis();      
-  currentOnStartDateTime = _timeNow;
-  sensorState = TDIO_STATE_ON; 
-  intervalMillis = timer;
-   
-  #if TDIO_DEBUG
-    printStateChangeInfo();
-  #endif
-  
+  adoptStarted();
+  uint16_t slot = s - tdi;
+  if (s < tdi || !_pool.inUse(slot))
+    return -1;
+  flushSensor(s);
+  s->storeEEPROM(s->currentMonth, s->currentMonthOnDuration);
+  s->_active = false;
+  _pool.release(slot);
+  return 0;
 }
 
-
 //--------------------------------------------------------
-void TimedDigitalOutput::setOff(void) {
-
-  setPin(TDIO_STATE_OFF);
+// Number of registered sensors
+uint16_t InputSensorArray::count(void) {
 
-  currentOnDuration = 0;
-  currentOnStartDateTime = 0;
-  sensorState = TDIO_STATE_OFF;
-  #if TDIO_DEBUG
-    printStateChangeInfo();
-  #endif  
-    
+  adoptStarted();
+  return _pool.count();
 }
 
 //--------------------------------------------------------
-void TimedDigitalOutput::setPin(uint8_t state) {
-      
-  if ((sensorLogic == TDIO_LOGIC_POSITIVE && state == TDIO_STATE_ON)  || 
-       (sensorLogic == TDIO_LOGIC_NEGATIVE && state == TDIO_STATE_OFF)) {
-     digitalWrite(sensorPin, HIGH);
-  
-  } else { 
-    digitalWrite(sensorPin, LOW);
-    
-  }   
-    
+// The n-th registered sensor, 0 <= n < count().
+// The order changes when a sensor is removed
+TimedDigitalInput *InputSensorArray::sensor(uint16_t n) {
+
+  return &tdi[_pool.slot(n)];
 }
 
 //--------------------------------------------------------
-void TimedDigitalOutput::checkTimer(void) {
+// Reads all registered sensors whose sampling period has passed. 
+// Free slots are not visited
+void InputSensorArray::readSensors(void) {
+
+  #if TDIO_EDGE_FLAGS && defined(PCIFR)
+    // Pin changes since the previous pass. Writing 1 clears a flag
+    uint8_t edgeFlags = PCIFR & _edgeGroups;
+    PCIFR = edgeFlags;
+    _changedGroupsPrevious = _changedGroups;
+    _changedGroups = 0;
+  #endif
 
-  uint32_t millisPassed;
+  adoptStarted();
+  uint32_t currentMillis = millis();
+  for (uint16_t n = 0; n < _pool.count(); n++) {
+    TimedDigitalInput *s = &tdi[_pool.slot(n)];
+    if (!s->sampleDue(currentMillis))
+      continue;
+    boolean changed = sampleSensor(s, false);
+    #if TDIO_EDGE_FLAGS && defined(PCIFR)
+      if (changed && digitalPinToPCMSK(s->sensorPin))
+        _changedGroups |= _BV(digitalPinToPCICRbit(s->sensorPin));
+    #else
+      (void)changed;
+    #endif
+    // A day or month change left a record for the history
+    if (s->_pendingStores != 0)
+      flushSensor(s);
+  }
 
-  if (intervalMillis > 0) {
-    millisPassed = millis() - _startMillis;
-    currentOnDuration = millisPassed;
-    if (millisPassed >= intervalMillis) {
-      setOff();
-      intervalMillis = 0;
-    }  
-  }    
-  
-}
+  #if TDIO_EDGE_FLAGS && defined(PCIFR)
+    // A flagged group where no sensor changed state, neither in this pass nor in the 
+    // previous one, had an even number of changes between two samples
+    edgeFlags &= ~(_changedGroups | _changedGroupsPrevious);
+    for (; edgeFlags != 0; edgeFlags &= edgeFlags - 1)
+      ++missedPulses;
+  #endif
 
+  if (_checkpointPending)
+    saveCheckpoint();
+}
 
 //--------------------------------------------------------
-void TimedDigitalOutput::printStateChangeInfo(void) {
-
-  Serial.print(F("***** "));
-  printHumanTime(now());
-  Serial.print(F(" Sensor '")); Serial.print(sensorName);
-  Serial.print(F("' State of pin ")); Serial.print(sensorPin);
-  Serial.print(F(" changed to "));
-  if (sensorState == TDIO_STATE_ON)
-    Serial.println(F("ON"));
-  else
-    Serial.println(F("OFF"));  
- 
-} 
+// Samples a sensor for readSensors() and scan(), measuring the interval
+// since its previous sample. Returns true if the sensor changed state
+boolean InputSensorArray::sampleSensor(TimedDigitalInput *s, boolean deferStores) {
+
+  uint32_t lastSampleMillis = s->_lastSampleMillis;
+  uint8_t previousState = s->sensorState;
+  s->sample(deferStores);
+  boolean changed = s->sensorState != previousState;
+
+  // The first sample after begin() has no interval
+  if (lastSampleMillis == 0)
+    return changed;
+
+  uint32_t interval = s->_lastSampleMillis - lastSampleMillis;
+  if (interval > longestSampleInterval)
+    longestSampleInterval = interval;
+  if (interval > (uint32_t)s->samplePeriod + maxSampleLateness) {
+    ++lateSamples;
+    if (s->lateSamples < 0xFFFF)
+      ++s->lateSamples;
+    if (!changed) {
+      ++possibleMissedPulses;
+      if (s->possibleMissedPulses < 0xFFFF)
+        ++s->possibleMissedPulses;
+      #if TDIO_DEBUG
+        Serial.print(s->sensorName);
+        Serial.print(F(" not sampled for "));
+        Serial.print(interval);
+        Serial.println(F(" ms, a pulse may have been missed"));
+      #endif
+    }
+  }
+  return changed;
+}
 
 //--------------------------------------------------------
-// Check pin validity
-boolean TimedDigitalOutput::pinValid(uint8_t mypin) {
+// Clears the sampling interval measurements of the array and of its sensors
+void InputSensorArray::resetSampleCounters(void) {
+
+  longestSampleInterval = 0;
+  lateSamples = 0;
+  possibleMissedPulses = 0;
+  #if TDIO_EDGE_FLAGS && defined(PCIFR)
+    missedPulses = 0;
+  #endif
+  for (uint16_t i = 0; i < TDI_MAX_SENSORS; i++) {
+    tdi[i].lateSamples = 0;
+    tdi[i].possibleMissedPulses = 0;
+  }
+}
 
-  // You may designate specific pins to be used as outputs, referencing pins_arduino.h
+#if TDIO_SAMPLER
+//--------------------------------------------------------
 /*
-  if (mypin >= 4 && mypin <= 8) 
-    return true;
-  else
-    return false;
+  Sampling side of a split between sampling and accounting, for dual core boards.
+  captureSensors() runs on one core or in a task of its own at a fixed rate, e.g. every
+  millisecond, and only reads the pins. accountSensors() runs in loop() on the other core
+  and does everything else: durations, energy, EEPROM, history, printing.
+  A slow accounting pass, e.g. a month change, never delays a capture.
+
+  The sampler keeps for each sensor its ON time and the number of times it came ON,
+  and publishes a copy of them after each pass, protected by a sequence number
+  (a seqlock). The sampler never waits. The accounting copies the snapshot
+  and retries if the sampler published in the meantime.
+
+  Register the sensors before the sampler starts. add() and remove() while it runs
+  may credit a sample to the wrong sensor. Do not call readSensors() or scan() 
+  together with accountSensors(). On a single core, the sampler must be able to
+  interrupt the accounting, e.g. a task of higher priority or a timer interrupt.
 */
-  return true;   
+void InputSensorArray::captureSensors(void) {
+
+  uint32_t currentMillis = millis();
+  uint32_t millisPassed = currentMillis - _sampled.sampleMillis;
+  _sampled.sampleMillis = currentMillis;
+
+  for (uint16_t n = 0; n < _pool.count(); n++) {
+    uint16_t slot = _pool.slot(n);
+    TimedDigitalInput *s = &tdi[slot];
+    uint8_t value = digitalRead(s->sensorPin);
+    boolean on = (s->sensorLogic == TDIO_LOGIC_POSITIVE) ? (value == HIGH) : (value == LOW);
+    uint8_t mask = 1 << (slot & 7);
+    // As in readSensor(), the time since the previous capture counts as ON if the sensor was ON
+    if (_sampled.states[slot >> 3] & mask)
+      _sampled.onMillis[slot] += millisPassed;
+    else if (on)
+      ++_sampled.onEdges[slot];
+    if (on)
+      _sampled.states[slot >> 3] |= mask;
+    else
+      _sampled.states[slot >> 3] &= ~mask;
+  }
+
+  // Publish. An odd sequence number tells the accounting that the copy is being written
+  ++_sequence;
+  TDIO_MEMORY_BARRIER();
+  memcpy(&_published, &_sampled, sizeof(_published));
+  TDIO_MEMORY_BARRIER();
+  ++_sequence;
 }
 
 //--------------------------------------------------------
-static void OutputSensorArray::printSensorData(TimedDigitalOutput *s) {
+// Accounting side, see captureSensors(). Adds to the durations of the registered 
+// sensors what the sampler measured since the previous call, and performs
+// the EEPROM writes and the history records.
+// Returns 0, or -1 if the sampler kept publishing for TDIO_SAMPLER_WAIT micros.
+// Nothing is lost then, the next call adds it
+int InputSensorArray::accountSensors(void) {
+
+  uint32_t startMicros = micros();
+  for (;;) {
+    tdio_seq_t sequence = _sequence;
+    TDIO_MEMORY_BARRIER();
+    if (!(sequence & 1)) {
+      memcpy(&_accounted, &_published, sizeof(_accounted));
+      TDIO_MEMORY_BARRIER();
+      if (_sequence == sequence)
+        break;
+    }
+    if (micros() - startMicros >= TDIO_SAMPLER_WAIT)
+      return -1;
+  }
+
+  adoptStarted();
+  for (uint16_t n = 0; n < _pool.count(); n++) {
+    uint16_t slot = _pool.slot(n);
+    TimedDigitalInput *s = &tdi[slot];
+    uint8_t state = (_accounted.states[slot >> 3] & (1 << (slot & 7))) ? TDIO_STATE_ON : TDIO_STATE_OFF;
+    s->account(state, 
+               _accounted.onMillis[slot] - s->_accountedOnMillis, 
+               _accounted.onEdges[slot] - s->_accountedOnEdges, 
+               false);
+    s->_accountedOnMillis = _accounted.onMillis[slot];
+    s->_accountedOnEdges = _accounted.onEdges[slot];
+    // A day or month change left a record for the history
+    if (s->_pendingStores != 0)
+      flushSensor(s);
+  }
+
+  if (_checkpointPending)
+    saveCheckpoint();
+  return 0;
+}
+#endif
+
+#if TDIO_EDGE_FLAGS && defined(PCIFR)
+//--------------------------------------------------------
+/*
+  Enables the pin change flags of the registered sensors, without enabling
+  the pin change interrupts. Call after registering the sensors.
+  readSensors() then counts in missedPulses the changes it did not see.
+  A group of pins shares one flag, so the other pins of the group must not 
+  change, e.g. they are unused or outputs, and the sensors of a group must
+  be sampled on every pass, i.e. have TDIO_PRIORITY_FAST.
+  Pins without pin change support are not checked.
+*/
+void InputSensorArray::enableEdgeFlags(void) {
+
+  _edgeGroups = 0;
+  for (uint16_t n = 0; n < _pool.count(); n++) {
+    uint8_t pin = tdi[_pool.slot(n)].sensorPin;
+    if (!digitalPinToPCMSK(pin))
+      continue;
+    *digitalPinToPCMSK(pin) |= _BV(digitalPinToPCMSKbit(pin));
+    _edgeGroups |= _BV(digitalPinToPCICRbit(pin));
+  }
+  // Start from clean flags
+  PCIFR = _edgeGroups;
+  _changedGroups = 0;
+  _changedGroupsPrevious = 0;
+}
+#endif
+
+//--------------------------------------------------------
+// Exponential moving average with a weight of 1/8 for the new value. The first value is taken as is
+static void tdioSmooth(uint32_t &average, uint32_t value) {
+
+  if (average == 0)
+    average = value;
+  else
+    average += ((int32_t)value - (int32_t)average) / 8;
+}
+
+//--------------------------------------------------------
+/*
+  Cooperative scan, an alternative to readSensors() for large arrays.
+  Reads the registered sensors round-robin for up to budgetMicros and returns,
+  so that the loop is never held longer than the budget. The next call continues 
+  from the sensor where this call stopped. At least one sensor is visited per call.
+
+  The EEPROM writes of the sensors (periodic and month change) are queued and 
+  performed one sensor per call, before reading. A month change of many sensors
+  is thus spread over many calls instead of blocking a single pass.
+
+  If maxStalenessMicros is not 0, the budget is ignored when stopping would let the 
+  round over all sensors last longer than that. scan() estimates the rest of the round 
+  from the smoothed time per sensor and the smoothed time between two calls, i.e. the 
+  rest of loop(). This keeps the age of the oldest sample near the target at the cost 
+  of a longer call, but it is not a guarantee: a loop() slower than usual or sensors 
+  slower than measured make the round longer. Check maxRoundMicros.
+
+  Sensors whose sampling period has not passed are skipped, see setPriority().
+  Returns the number of sensors read.
+*/
+uint16_t InputSensorArray::scan(uint32_t budgetMicros) {
+
+  uint32_t startMicros = micros();
+  uint16_t done = 0;
+
+  adoptStarted();
+  if (!_roundStarted) {
+    _roundStarted = true;
+    _roundStartMicros = startMicros;
+  } else {
+    tdioSmooth(_scanGapMicros, startMicros - _scanEndMicros);
+  }
+
+  if (_pendingCount > 0) {
+    uint16_t slot = _pendingQueue[_pendingHead];
+    _pendingHead = (_pendingHead + 1) % TDI_MAX_SENSORS;
+    --_pendingCount;
+    flushSensor(&tdi[slot]);
+  } else if (_checkpointPending) {
+    // One EEPROM task per call
+    saveCheckpoint();
+  }
+
+  // A call visits each sensor at most once, even if none is due
+  for (uint16_t visited = 0; visited < _pool.count(); visited++) {
+
+    if (_scanPosition >= _pool.count()) {
+      // Round completed
+      uint32_t currentMicros = micros();
+      lastRoundMicros = currentMicros - _roundStartMicros;
+      if (lastRoundMicros > maxRoundMicros)
+        maxRoundMicros = lastRoundMicros;
+      ++roundsCompleted;
+      _roundStartMicros = currentMicros;
+      _scanPosition = 0;
+    }
+
+    uint16_t slot = _pool.slot(_scanPosition);
+    TimedDigitalInput *s = &tdi[slot];
+    ++_scanPosition;
+    // Sensors that are not due are skipped, and do not count against the budget
+    if (!s->sampleDue(millis()))
+      continue;
+    sampleSensor(s, true);
+    ++done;
+
+    // Queue the sensor if it has new pending writes. A full queue is flushed at once
+    if (s->_pendingStores != 0 && !(s->_pendingStores & TDIO_PENDING_QUEUED)) {
+      if (_pendingCount < TDI_MAX_SENSORS) {
+        s->_pendingStores |= TDIO_PENDING_QUEUED;
+        _pendingQueue[(_pendingHead + _pendingCount) % TDI_MAX_SENSORS] = slot;
+        ++_pendingCount;
+      } else {
+        flushSensor(s);
+      }
+    }
+
+    uint32_t currentMicros = micros();
+    if (currentMicros - startMicros >= budgetMicros) {
+      if (_scanPosition >= _pool.count() || !roundOverdue(currentMicros, budgetMicros))
+        break;
+    }
+  }
+
+  _scanEndMicros = micros();
+  if (done > 0)
+    tdioSmooth(_scanSensorMicros, (_scanEndMicros - startMicros) / done);
+
+  return done;
+}
+
+//--------------------------------------------------------
+// True if the round of scan() would last longer than maxStalenessMicros, 
+// if scan() stopped now and the next calls read budgetMicros worth of sensors each
+boolean InputSensorArray::roundOverdue(uint32_t currentMicros, uint32_t budgetMicros) {
+
+  if (maxStalenessMicros == 0)
+    return false;
+  uint32_t elapsed = currentMicros - _roundStartMicros;
+  if (elapsed >= maxStalenessMicros)
+    return true;
+  uint32_t rest = (uint32_t)(_pool.count() - _scanPosition) * _scanSensorMicros;
+  uint32_t calls = (budgetMicros > 0) ? rest / budgetMicros + 1 : 1;
+  return rest + calls * _scanGapMicros >= maxStalenessMicros - elapsed;
+}
+
+//--------------------------------------------------------
+// Performs everything a sensor left pending: its history records and its EEPROM writes
+void InputSensorArray::flushSensor(TimedDigitalInput *s) {
+
+  #if TDIO_HISTORY
+    uint16_t thisYear = year(now());
+    // A month after the current one belongs to the previous year, e.g. December closed in January
+    if (s->_pendingStores & TDIO_PENDING_HISTORY_MONTH)
+      historyAppend(TDIO_HISTORY_MONTH, s->EEPROMBlock, 
+                    (s->_closedMonth > s->currentMonth) ? thisYear - 1 : thisYear,
+                    s->_closedMonth, 0, s->_closedMonthOnDuration, s->_closedMonthEnergy);
+    #if TDIO_HISTORY_DAILY
+      if (s->_pendingStores & TDIO_PENDING_HISTORY_DAY)
+        historyAppend(TDIO_HISTORY_DAY, s->EEPROMBlock, 
+                      (s->_closedDayMonth > s->currentMonth) ? thisYear - 1 : thisYear,
+                      s->_closedDayMonth, s->_closedDay, s->_closedDayOnDuration, 0);
+    #endif
+  #endif
+  s->flushPendingStores();
+}
+
+//--------------------------------------------------------
+// Number of sensors read so far in the current round of scan()
+uint16_t InputSensorArray::scanPosition(void) {
+
+  return _scanPosition;
+}
+
+//--------------------------------------------------------
+// Number of sensors with EEPROM writes queued by scan()
+uint16_t InputSensorArray::pendingStores(void) {
+
+  return _pendingCount;
+}
+
+//--------------------------------------------------------
+// Location of a checkpoint slot in EEPROM
+static int checkpointSlotAddress(uint8_t slot) {
+
+  return TDIO_CHECKPOINT_OFFSET + slot * (sizeof(TdioCheckpointHeader) + TDI_MAX_SENSORS * sizeof(TdioCheckpointRecord));
+}
+
+//--------------------------------------------------------
+// Asks for a checkpoint, saved by the next readSensors(), scan() or accountSensors(),
+// for callers that must not wait for the EEPROM, e.g. TdioProtocol
+void InputSensorArray::saveCheckpointLater(void) {
+
+  _checkpointPending = true;
+}
+
+//--------------------------------------------------------
+// Writes the counters of all configured sensors to the older of the two checkpoint slots.
+// The records are written first and the header last. If power fails in between, 
+// the CRC of the slot does not match and the previous checkpoint remains the newest valid one.
+// EEPROM.put() skips the bytes that did not change, and each slot is written every
+// second checkpoint, so an hourly checkpoint gives more than 20 years of EEPROM life.
+int InputSensorArray::saveCheckpoint(void) {
+
+  TdioCheckpointHeader header;
+  TdioCheckpointRecord record;
+  _checkpointPending = false;
+  uint8_t slot = 1 - _checkpointSlot;
+  int address = checkpointSlotAddress(slot) + sizeof(TdioCheckpointHeader);
+  uint16_t crc = 0xFFFF;
+  uint16_t count = 0;
+
+  // Clear the padding bytes of the structures on 32 bit platforms, so that they do not cause EEPROM writes
+  memset(&header, 0, sizeof(header));
+  memset(&record, 0, sizeof(record));
+
+  adoptStarted();
+  for (uint16_t n = 0; n < _pool.count(); n++) {
+    TimedDigitalInput *s = &tdi[_pool.slot(n)];
+    record.eepromBlock = s->EEPROMBlock;
+    record.month = s->currentMonth;
+    record.day = s->currentDay;
+    record.monthOnDuration = s->currentMonthOnDuration;
+    record.todayOnDuration = s->todayOnDuration;
+    record.todayOnCounter = s->todayOnCounter;
+    record.monthEnergy = s->currentMonthEnergy;
+    record.todayEnergy = s->todayEnergy;
+    EEPROM.put(address, record);
+    #if TDIO_STATS
+      ++tdioStats.eepromWrites;
+    #endif
+    crc = tdioCrc16(crc, (const uint8_t *)&record, sizeof(record));
+    address += sizeof(record);
+    ++count;
+  }
+
+  header.sequence = _checkpointSequence + 1;
+  header.time = now();
+  header.version = TDIO_CHECKPOINT_VERSION;
+  header.count = count;
+  header.crc = tdioCrc16(crc, (const uint8_t *)&header, offsetof(TdioCheckpointHeader, crc));
+  EEPROM.put(checkpointSlotAddress(slot), header);
+  #if TDIO_STATS
+    ++tdioStats.eepromWrites;
+  #endif
+
+  _checkpointSequence = header.sequence;
+  _checkpointSlot = slot;
+
+  #if TDIO_DEBUG
+    Serial.print(F("##########  "));
+    printHumanTime(now());
+    Serial.print(F(" Checkpoint ")); Serial.print(header.sequence);
+    Serial.print(F(" of ")); Serial.print(count);
+    Serial.print(F(" sensors to slot ")); Serial.println(slot);
+  #endif
+
+  return 0;
+}
+
+//--------------------------------------------------------
+// Must be called once, after begin() of all sensors.
+// Finds the newest valid checkpoint and restores from it the counters of the sensors,
+// matched by their EEPROM block. A record of the current month is merged with the counters.
+// A record of one of the 11 months before gives the total of that month, which closed
+// while the power was off. Older records are ignored. Returns the number of restored sensors,
+// or -1 if there is no valid checkpoint, e.g. on a factory-fresh EEPROM.
+// The slot is checked completely before the running counters are touched.
+int InputSensorArray::restoreCheckpoint(void) {
+
+  adoptStarted();
+  return loadCheckpoint(false);
+}
+
+//--------------------------------------------------------
+// Restores from the newest valid checkpoint slot, or from the other slot if the CRC of the newest fails.
+// If fresh is true, the sensors were just initialised by begin(table) with an unknown month total
+// (EEPROM_ERASED_VALUE). The records are then applied while the CRC is computed, so the slot is
+// read only once, and the counters are initialised again if the CRC does not match
+int InputSensorArray::loadCheckpoint(boolean fresh) {
+
+  TdioCheckpointHeader header[2];
+  boolean plausible[2];
+
+  for (uint8_t slot = 0; slot < 2; slot++) {
+    EEPROM.get(checkpointSlotAddress(slot), header[slot]);
+    #if TDIO_STATS
+      ++tdioStats.eepromReads;
+    #endif
+    plausible[slot] = header[slot].version == TDIO_CHECKPOINT_VERSION && header[slot].count <= TDI_MAX_SENSORS;
+  }
+
+  // The newest slot first. Compare as signed to survive the wrap-around of the sequence number
+  uint8_t slot = (plausible[1] && (!plausible[0] || (int32_t)(header[1].sequence - header[0].sequence) > 0)) ? 1 : 0;
+
+  for (uint8_t attempt = 0; attempt < 2; attempt++, slot = 1 - slot) {
+    if (!plausible[slot])
+      continue;
+    int restored = -1;
+    if (fresh) {
+      restored = applyCheckpoint(slot, &header[slot]);
+      if (restored < 0)
+        for (uint16_t n = 0; n < _pool.count(); n++) {
+          TimedDigitalInput *s = &tdi[_pool.slot(n)];
+          s->initCounters(s->currentMonth, s->currentDay, EEPROM_ERASED_VALUE);
+        }
+    } else if (checkpointSlotValid(slot, &header[slot])) {
+      restored = applyCheckpoint(slot, &header[slot]);
+    }
+    if (restored < 0)
+      continue;
+
+    #if TDIO_DEBUG
+      Serial.print(F("Restored checkpoint ")); Serial.print(_checkpointSequence);
+      Serial.print(F(" from slot ")); Serial.print(slot);
+      Serial.print(F(" for ")); Serial.print(restored);
+      Serial.println(F(" sensors"));
+    #endif
+    return restored;
+  }
+
+  return -1;
+}
+
+//--------------------------------------------------------
+// Months from the month of a checkpoint record to the current month of its sensor.
+// A record of a month after the month of the checkpoint was saved before the change of year
+static int32_t checkpointMonthsAgo(const TdioCheckpointRecord *record, time_t checkpointTime,
+                                   uint16_t thisYear, uint8_t thisMonth) {
+
+  uint16_t recordYear = year(checkpointTime);
+  if (record->month > month(checkpointTime))
+    --recordYear;
+  return ((int32_t)thisYear - recordYear) * 12 + thisMonth - record->month;
+}
+
+//--------------------------------------------------------
+// Reads the records of a checkpoint slot once, merges the records of the current month into
+// their sensors and checks the CRC on the way. Returns the number of sensors restored, or -1
+// if the CRC does not match. The months closed while the power was off are written to their
+// monthly blocks and to the history only after the CRC matched, with a second read of the slot
+int InputSensorArray::applyCheckpoint(uint8_t slot, const TdioCheckpointHeader *header) {
+
+  TdioCheckpointRecord record;
+  uint16_t crc = 0xFFFF;
+  int restored = 0;
+  boolean closedMonths = false;
+  time_t timeNow = now();
+  uint16_t thisYear = year(timeNow);
+  // The monthly blocks can have grown since the checkpoint by the time passed since then, at most
+  uint32_t sinceCheckpoint = (timeNow > header->time) ? (uint32_t)(timeNow - header->time) : 0;
+  sinceCheckpoint = (sinceCheckpoint > monthElapsedMillis(timeNow) / 1000) ? monthElapsedMillis(timeNow) : sinceCheckpoint * 1000;
+
+  int address = checkpointSlotAddress(slot) + sizeof(TdioCheckpointHeader);
+  for (uint16_t i = 0; i < header->count; i++, address += sizeof(record)) {
+
+    EEPROM.get(address, record);
+    #if TDIO_STATS
+      ++tdioStats.eepromReads;
+    #endif
+    crc = tdioCrc16(crc, (const uint8_t *)&record, sizeof(record));
+
+    TimedDigitalInput *s = findByEEPROMBlock(record.eepromBlock, i);
+    if (s == NULL)
+      continue;
+
+    // A record a year or more old, or from the future after a loss of the clock, is ignored:
+    // its month in the monthly block belongs to another year
+    int32_t monthsAgo = checkpointMonthsAgo(&record, header->time, thisYear, s->currentMonth);
+    if (monthsAgo == 0) {
+      // The monthly block is read in the same pass, since a periodic write may be more 
+      // recent than the checkpoint. Durations only grow within a month, so the larger value 
+      // is the most recent one, unless the block grew more than the time since the checkpoint:
+      // then it is left over from a previous year or torn, and the checkpoint is used
+      uint32_t monthOnDuration = s->readEEPROM(s->currentMonth);
+      if (monthOnDuration < record.monthOnDuration || monthOnDuration - record.monthOnDuration > sinceCheckpoint)
+        monthOnDuration = record.monthOnDuration;
+      s->currentMonthOnDuration = monthOnDuration;
+      if (record.monthEnergy > s->currentMonthEnergy)
+        s->currentMonthEnergy = record.monthEnergy;
+      if (record.day == s->currentDay) {
+        s->todayOnDuration = record.todayOnDuration;
+        s->todayOnCounter = record.todayOnCounter;
+        s->todayEnergy = record.todayEnergy;
+      }
+      ++restored;
+    } else if (monthsAgo > 0 && monthsAgo < 12) {
+      // The current month started after the checkpoint. Its monthly block was not zeroed 
+      // if the power was off at the change of the month before, so it is not trusted
+      s->currentMonthOnDuration = 0;
+      closedMonths = true;
+      ++restored;
+    }
+  }
+
+  crc = tdioCrc16(crc, (const uint8_t *)header, offsetof(TdioCheckpointHeader, crc));
+  if (crc != header->crc)
+    return -1;
+
+  _checkpointSlot = slot;
+  _checkpointSequence = header->sequence;
+
+  if (!closedMonths)
+    return restored;
+
+  // A month closed while the power was off. The checkpoint has its most recent total
+  address = checkpointSlotAddress(slot) + sizeof(TdioCheckpointHeader);
+  for (uint16_t i = 0; i < header->count; i++, address += sizeof(record)) {
+    EEPROM.get(address, record);
+    #if TDIO_STATS
+      ++tdioStats.eepromReads;
+    #endif
+    TimedDigitalInput *s = findByEEPROMBlock(record.eepromBlock, i);
+    if (s == NULL)
+      continue;
+    int32_t monthsAgo = checkpointMonthsAgo(&record, header->time, thisYear, s->currentMonth);
+    if (monthsAgo <= 0 || monthsAgo >= 12)
+      continue;
+    if (record.monthOnDuration > s->readEEPROM(record.month))
+      s->storeEEPROM(record.month, record.monthOnDuration);
+    #if TDIO_HISTORY
+      // The month never reached the history, unless it closed before the power failed
+      uint16_t closedMonth = (uint16_t)(thisYear * 12 + s->currentMonth - 1 - monthsAgo);
+      if (!_historyOpen)
+        openHistory();
+      if (closedMonth > _historyLastMonth[record.eepromBlock])
+        historyAppend(TDIO_HISTORY_MONTH, record.eepromBlock, closedMonth / 12, record.month, 0,
+                      record.monthOnDuration, record.monthEnergy);
+    #endif
+  }
+
+  return restored;
+}
+
+//--------------------------------------------------------
+// Checks the CRC over the header of a slot, already read, and its records
+boolean InputSensorArray::checkpointSlotValid(uint8_t slot, const TdioCheckpointHeader *header) {
+
+  TdioCheckpointRecord record;
+  uint16_t crc = 0xFFFF;
+
+  int address = checkpointSlotAddress(slot) + sizeof(TdioCheckpointHeader);
+  for (uint16_t i = 0; i < header->count; i++, address += sizeof(record)) {
+    EEPROM.get(address, record);
+    #if TDIO_STATS
+      ++tdioStats.eepromReads;
+    #endif
+    crc = tdioCrc16(crc, (const uint8_t *)&record, sizeof(record));
+  }
+  crc = tdioCrc16(crc, (const uint8_t *)header, offsetof(TdioCheckpointHeader, crc));
+
+  return crc == header->crc;
+}
+
+//--------------------------------------------------------
+// Returns the registered sensor that logs to eepromBlock, or NULL.
+// The n-th registered sensor (hint) is tried first, since the sensors are usually 
+// restored in the order they were saved
+TimedDigitalInput *InputSensorArray::findByEEPROMBlock(uint8_t eepromBlock, uint16_t hint) {
+
+  if (hint < _pool.count() && tdi[_pool.slot(hint)].EEPROMBlock == eepromBlock)
+    return &tdi[_pool.slot(hint)];
+
+  for (uint16_t n = 0; n < _pool.count(); n++)
+    if (tdi[_pool.slot(n)].EEPROMBlock == eepromBlock)
+      return &tdi[_pool.slot(n)];
+
+  return NULL;
+}
+
+
+#if TDIO_HISTORY
+
+////////////  Compressed history ////////////////////////
+/*
+  The history is a log of records in the EEPROM area of TDIO_HISTORY_SIZE bytes
+  at TDIO_HISTORY_OFFSET. The area is a ring of pages of TDIO_HISTORY_PAGE bytes.
+  A page starts with its sequence number (0-254, one more than the previous page,
+  modulo 255), followed by a year record and by the records appended to it.
+  The records of a page end at the first TDIO_HISTORY_END byte, which is also 
+  the value of an erased EEPROM, or at the end of the page. Records:
+
+    TDIO_HISTORY_YEAR          year, resolution in seconds
+    TDIO_HISTORY_MONTH + month eepromBlock, delta
+    TDIO_HISTORY_MONTH_ENERGY + month
+                               eepromBlock, delta, energy delta
+    TDIO_HISTORY_DAY           eepromBlock, month * 32 + day, delta
+
+  The numbers after the first byte are varints: 7 bits per byte, low bits first, 
+  the high bit set on all bytes but the last. A delta is the on-duration, 
+  in units of the resolution, minus the previous duration of the same kind for 
+  the same EEPROM block, zig-zag encoded so that small negative values stay short.
+  The energy delta is the energy of the month in Wh minus the energy of the previous 
+  monthly record of the block, which is 0 for a record without energy.
+  A year record starts a new year and sets all previous durations to zero, 
+  so each page can be decoded on its own.
+
+  When a record does not fit in the current page, the next page is started. 
+  Once all pages are in use, that is the oldest page, whose records are dropped.
+
+  A monthly record of one sensor usually takes 4 bytes with minute resolution, 
+  and 5 bytes as the first record of the sensor in a page, plus 1 or 2 bytes with energy, so a 512 byte log keeps 
+  about 2 years of 4 sensors instead of the 12 months of the monthly blocks.
+*/
+
+//--------------------------------------------------------
+static uint8_t putVarint(uint8_t *p, uint32_t value) {
+
+  uint8_t length = 0;
+  while (value >= 0x80) {
+    p[length++] = (value & 0x7F) | 0x80;
+    value >>= 7;
+  }
+  p[length++] = value;
+  return length;
+}
+
+//--------------------------------------------------------
+// Reads a varint of the log at *position and advances it.
+// Returns false if the varint runs past limit or is too long
+static boolean readHistoryVarint(uint16_t *position, uint16_t limit, uint32_t *value) {
+
+  *value = 0;
+  for (uint8_t shift = 0; shift < 35; shift += 7) {
+    if (*position >= limit)
+      return false;
+    uint8_t b = EEPROM.read(TDIO_HISTORY_OFFSET + (*position)++);
+    *value |= (uint32_t)(b & 0x7F) << shift;
+    if (!(b & 0x80))
+      return true;
+  }
+  return false;
+}
+
+//--------------------------------------------------------
+static uint32_t zigzag(int32_t value) {
+
+  return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+}
+
+static int32_t unzigzag(uint32_t value) {
+
+  return (int32_t)(value >> 1) ^ -(int32_t)(value & 1);
+}
+
+//--------------------------------------------------------
+// Sequence number of the page after a page. TDIO_HISTORY_END is never used
+static uint8_t nextHistorySequence(uint8_t sequence) {
+
+  return (sequence + 1) % TDIO_HISTORY_END;
+}
+
+//--------------------------------------------------------
+static uint8_t historyYearRecord(uint8_t *record, uint16_t year) {
+
+  record[0] = TDIO_HISTORY_YEAR;
+  uint8_t length = 1;
+  length += putVarint(record + length, year);
+  length += putVarint(record + length, TDIO_HISTORY_RESOLUTION);
+  return length;
+}
+
+//--------------------------------------------------------
+// Reads the log to find its end and the state needed to continue appending.
+// Called automatically before the first append. Returns the number of duration records
+int InputSensorArray::openHistory(void) {
+
+  return historyDecode(NULL);
+}
+
+//--------------------------------------------------------
+// Streams the log from the oldest record, calling callback once for each duration record.
+// Only one record is in RAM at a time. Returns the number of duration records
+int InputSensorArray::readHistory(TdioHistoryCallback callback) {
+
+  return historyDecode(callback);
+}
+
+//--------------------------------------------------------
+// Erases the log. Only the first byte of each page is written
+int InputSensorArray::clearHistory(void) {
+
+  for (uint8_t page = 0; page < TDIO_HISTORY_PAGES; page++) {
+    EEPROM.put(TDIO_HISTORY_OFFSET + page * TDIO_HISTORY_PAGE, (uint8_t)TDIO_HISTORY_END);
+    #if TDIO_STATS
+      ++tdioStats.eepromWrites;
+    #endif
+  }
+  historyWrapped = false;
+  return historyDecode(NULL);
+}
+
+//--------------------------------------------------------
+// Number of bytes of the log in use
+uint16_t InputSensorArray::historyUsed(void) {
+
+  if (!_historyOpen)
+    openHistory();
+  if (_historyPages == 0)
+    return 0;
+  return (_historyPages - 1) * TDIO_HISTORY_PAGE + _historyEnd;
+}
+
+//--------------------------------------------------------
+// Year, resolution and previous durations after a year record
+void InputSensorArray::historyResetBases(uint16_t year, uint16_t resolution) {
+
+  _historyYear = year;
+  _historyResolution = resolution;
+  memset(_historyMonthBase, 0, sizeof(_historyMonthBase));
+  memset(_historyEnergyBase, 0, sizeof(_historyEnergyBase));
+  #if TDIO_HISTORY_DAILY
+    memset(_historyDayBase, 0, sizeof(_historyDayBase));
+  #endif
+}
+
+//--------------------------------------------------------
+// Decodes the whole log, from the page after the newest one. Decoding rebuilds the
+// year, resolution and previous durations that the writer needs, so a full read also 
+// leaves the writer ready. The newest page is the one not followed by the next sequence number
+int InputSensorArray::historyDecode(TdioHistoryCallback callback) {
+
+  uint8_t sequence[TDIO_HISTORY_PAGES];
+  int newest = -1;
+  int count = 0;
+
+  _historyPages = 0;
+  memset(_historyLastMonth, 0, sizeof(_historyLastMonth));
+  for (uint8_t page = 0; page < TDIO_HISTORY_PAGES; page++) {
+    sequence[page] = EEPROM.read(TDIO_HISTORY_OFFSET + page * TDIO_HISTORY_PAGE);
+    if (sequence[page] != TDIO_HISTORY_END)
+      ++_historyPages;
+  }
+  #if TDIO_STATS
+    tdioStats.eepromReads += TDIO_HISTORY_PAGES;
+  #endif
+  for (uint8_t page = 0; page < TDIO_HISTORY_PAGES && newest < 0; page++) {
+    uint8_t next = (page + 1) % TDIO_HISTORY_PAGES;
+    if (sequence[page] != TDIO_HISTORY_END && sequence[next] != nextHistorySequence(sequence[page]))
+      newest = page;
+  }
+
+  historyResetBases(0, 0);
+  if (newest < 0) {
+    // Empty log. The first append starts page 0 with sequence number 0
+    _historyPage = TDIO_HISTORY_PAGES - 1;
+    _historySequence = TDIO_HISTORY_END - 1;
+    _historyEnd = TDIO_HISTORY_PAGE;
+  } else {
+    // The newest page is decoded last, and leaves its state to the writer
+    for (uint8_t i = 1; i <= TDIO_HISTORY_PAGES; i++) {
+      uint8_t page = (newest + i) % TDIO_HISTORY_PAGES;
+      if (sequence[page] != TDIO_HISTORY_END)
+        count += historyDecodePage(page, callback);
+    }
+    _historyPage = newest;
+    _historySequence = sequence[newest];
+  }
+
+  _historyOpen = true;
+  return count;
+}
+
+//--------------------------------------------------------
+// Decodes the records of a page and sets _historyEnd after the last one.
+// A record that cannot be decoded is taken as the end of the page, and is overwritten by the next append
+int InputSensorArray::historyDecodePage(uint8_t page, TdioHistoryCallback callback) {
+
+  TdioHistoryEntry entry;
+  uint16_t start = page * TDIO_HISTORY_PAGE;
+  uint16_t limit = start + TDIO_HISTORY_PAGE;
+  uint16_t position = start + 1;
+  // End of the last record decoded successfully
+  uint16_t end = position;
+  int count = 0;
+
+  // Each page starts with a year record
+  historyResetBases(0, 0);
+
+  while (position < limit) {
+
+    uint8_t type = EEPROM.read(TDIO_HISTORY_OFFSET + position++);
+    uint32_t value;
+
+    if (type == TDIO_HISTORY_YEAR) {
+      uint32_t resolution;
+      if (!readHistoryVarint(&position, limit, &value) || !readHistoryVarint(&position, limit, &resolution) || resolution == 0)
+        break;
+      historyResetBases(value, resolution);
+      end = position;
+      continue;
+    }
+
+    boolean monthly = ((type & 0xF0) == TDIO_HISTORY_MONTH || (type & 0xF0) == TDIO_HISTORY_MONTH_ENERGY) 
+                      && (type & 0x0F) >= 1 && (type & 0x0F) <= 12;
+    if ((!monthly && type != TDIO_HISTORY_DAY) || _historyResolution == 0)
+      break;
+
+    uint32_t eepromBlock;
+    if (!readHistoryVarint(&position, limit, &eepromBlock) || eepromBlock >= TDI_MAX_SENSORS)
+      break;
+
+    if (monthly) {
+      entry.month = type & 0x0F;
+      entry.day = 0;
+    } else {
+      if (!readHistoryVarint(&position, limit, &value))
+        break;
+      entry.month = value / 32;
+      entry.day = value % 32;
+    }
+
+    if (!readHistoryVarint(&position, limit, &value))
+      break;
+
+    uint32_t *base;
+    entry.energy = 0;
+    if (monthly) {
+      if ((type & 0xF0) == TDIO_HISTORY_MONTH_ENERGY) {
+        uint32_t energyDelta;
+        if (!readHistoryVarint(&position, limit, &energyDelta))
+          break;
+        entry.energy = _historyEnergyBase[eepromBlock] + unzigzag(energyDelta);
+      }
+      _historyEnergyBase[eepromBlock] = entry.energy;
+      uint16_t logged = _historyYear * 12 + entry.month - 1;
+      if (logged > _historyLastMonth[eepromBlock])
+        _historyLastMonth[eepromBlock] = logged;
+      base = &_historyMonthBase[eepromBlock];
+    } else {
+      #if TDIO_HISTORY_DAILY
+        base = &_historyDayBase[eepromBlock];
+      #else
+        // Daily records of a previous configuration are skipped
+        end = position;
+        continue;
+      #endif
+    }
+    *base += unzigzag(value);
+
+    entry.year = _historyYear;
+    entry.eepromBlock = eepromBlock;
+    entry.onDuration = *base * _historyResolution * 1000UL;
+    if (callback != NULL)
+      callback(&entry);
+    ++count;
+    end = position;
+  }
+
+  #if TDIO_STATS
+    tdioStats.eepromReads += position - start;
+  #endif
+
+  _historyEnd = end - start;
+  return count;
+}
+
+//--------------------------------------------------------
+// Appends a duration record, preceded by a year record when the year or the resolution changes.
+// A record that does not fit in the current page goes to the next page
+void InputSensorArray::historyAppend(uint8_t type, uint8_t eepromBlock, uint16_t year, uint8_t month, uint8_t day, uint32_t onDuration, uint32_t energy) {
+
+  uint8_t yearRecord[8];
+  uint8_t yearLength = 0;
+  uint8_t record[16];
+  uint8_t length;
+
+  if (!_historyOpen)
+    openHistory();
+
+  boolean newYear = year != _historyYear || _historyResolution != TDIO_HISTORY_RESOLUTION;
+  if (newYear)
+    yearLength = historyYearRecord(yearRecord, year);
+
+  uint32_t units = onDuration / (TDIO_HISTORY_RESOLUTION * 1000UL);
+  uint32_t *base = &_historyMonthBase[eepromBlock];
+  #if TDIO_HISTORY_DAILY
+    if (type == TDIO_HISTORY_DAY)
+      base = &_historyDayBase[eepromBlock];
+  #endif
+
+  // A year record sets the previous duration to zero. The record is encoded with the 
+  // longest delta, so that it still fits if it moves to a new page
+  length = 1;
+  length += putVarint(record + length, eepromBlock);
+  if (type == TDIO_HISTORY_MONTH) {
+    record[0] = ((energy > 0) ? TDIO_HISTORY_MONTH_ENERGY : TDIO_HISTORY_MONTH) | month;
+  } else {
+    record[0] = TDIO_HISTORY_DAY;
+    length += putVarint(record + length, month * 32 + day);
+  }
+  uint8_t headLength = length;
+  uint8_t energyLength = (record[0] & 0xF0) == TDIO_HISTORY_MONTH_ENERGY ? 5 : 0;
+
+  if (_historyEnd + yearLength + headLength + 5 + energyLength + 1 > TDIO_HISTORY_PAGE) {
+    historyStartPage(year);
+  } else if (newYear) {
+    historyWrite(yearRecord, yearLength);
+    historyResetBases(year, TDIO_HISTORY_RESOLUTION);
+  }
+
+  length = headLength + putVarint(record + headLength, zigzag((int32_t)(units - *base)));
+  if (energyLength > 0)
+    length += putVarint(record + length, zigzag((int32_t)(energy - _historyEnergyBase[eepromBlock])));
+  historyWrite(record, length);
+  *base = units;
+  if (type == TDIO_HISTORY_MONTH) {
+    _historyEnergyBase[eepromBlock] = energy;
+    uint16_t logged = year * 12 + month - 1;
+    if (logged > _historyLastMonth[eepromBlock])
+      _historyLastMonth[eepromBlock] = logged;
+  }
+}
+
+//--------------------------------------------------------
+// Starts the next page with a year record. If it is in use, it is the oldest page, 
+// and its records are dropped. Its sequence number is cleared first and written last,
+// so a page cut by a power failure is not in use
+void InputSensorArray::historyStartPage(uint16_t year) {
+
+  uint8_t record[8];
+  uint8_t page = (_historyPage + 1) % TDIO_HISTORY_PAGES;
+  int address = TDIO_HISTORY_OFFSET + page * TDIO_HISTORY_PAGE;
+
+  if (EEPROM.read(address) != TDIO_HISTORY_END) {
+    historyWrapped = true;
+    EEPROM.put(address, (uint8_t)TDIO_HISTORY_END);
+    #if TDIO_STATS
+      ++tdioStats.eepromWrites;
+    #endif
+  } else {
+    ++_historyPages;
+  }
+
+  _historyPage = page;
+  _historySequence = nextHistorySequence(_historySequence);
+  _historyEnd = 1;
+  historyWrite(record, historyYearRecord(record, year));
+  historyResetBases(year, TDIO_HISTORY_RESOLUTION);
+
+  EEPROM.put(address, _historySequence);
+  #if TDIO_STATS
+    ++tdioStats.eepromWrites;
+  #endif
+}
+
+//--------------------------------------------------------
+// Writes a record at the end of the current page, where it fits. The body and the new 
+// end marker are written first and the type byte, over the old end marker, last. 
+// If the power fails in between, the page still ends before the record
+void InputSensorArray::historyWrite(const uint8_t *record, uint8_t length) {
+
+  int address = TDIO_HISTORY_OFFSET + _historyPage * TDIO_HISTORY_PAGE + _historyEnd;
+  for (uint8_t i = 1; i < length; i++)
+    EEPROM.put(address + i, record[i]);
+  if (_historyEnd + length < TDIO_HISTORY_PAGE)
+    EEPROM.put(address + length, (uint8_t)TDIO_HISTORY_END);
+  EEPROM.put(address, record[0]);
+  #if TDIO_STATS
+    tdioStats.eepromWrites += length + 1;
+  #endif
+
+  _historyEnd += length;
+}
+
+#endif // TDIO_HISTORY
+
+
+////////////  Digital Output ////////////////////////
+
+uint16_t TimedDigitalOutput::_startedCount = 0;
+
+// Class constructor
+TimedDigitalOutput::TimedDigitalOutput() {
+}
+
+/*
+  Must be called for each sensor 
+    name: The name of the sensor, at it will appear on printouts, e.g. "Heater"
+    pinCode: The Arduino pin that is associated with the sensor, e.g. 5
+    logic: TDIO_LOGIC_POSITIVE or TDIO_LOGIC_NEGATIVE. Defines if the pin is active HIGH or active LOW
+    pullup: true or false. If true, the pin mode is defined as INPUT_PULLUP, otherwise as INPUT
+    eepromBlock: Defines the 48byte block of EEPROM whwre the monthly data of the sensor will be recorded
+*/
+int TimedDigitalOutput::begin(const char *name, uint8_t pinCode, uint8_t logic) {
+
+  // Check pin validity. 
+  if (pinValid(pinCode))
+    sensorPin = pinCode;
+  else
+    return -1;
+
+  /*
+    Set the logic of the sensor.
+    TDIO_LOGIC_POSITIVE means 1 is ON and 0 is OFF
+    TDIO_LOGIC_NEGATIVE means 0 is ON and 1 is OFF
+ */ 
+  if (logic == TDIO_LOGIC_POSITIVE)
+    sensorLogic = TDIO_LOGIC_POSITIVE;
+  else
+    sensorLogic = TDIO_LOGIC_NEGATIVE;
+
+  /*
+    Set the sensor name
+*/  
+  strncpy(sensorName, name, sizeof(sensorName) -1); 
+  sensorName[sizeof(sensorName)-1] = NULL;
+
+  /*
+    Set initial values for class variables
+  */ 
+  // Current state can be on or off, regardless of logic
+  sensorState = TDIO_STATE_OFF;
+  intervalMillis = 0;   
+   
+    // Time that the sensor is currently reporting as ON in millis
+  currentOnDuration = 0;
+    
+  // Time in unixtime when the pin started reporting state ON and is still ON
+  currentOnStartDateTime = 0;
+
+  // Energy in Wh since begin()
+  totalEnergy = 0;
+  _energyRemainder = 0;
+
+  _active = true;
+  ++_startedCount;
+
+  return 0;
+}
+
+
+//--------------------------------------------------------
+// If timer is set to a non zero value, the system will turn on 
+// and then off after timer millis
+void TimedDigitalOutput::setOn(uint32_t timer) {
+
+  _timeNow = now();
+
+  // Account the energy of a previous setOn() that is still running
+  recordEnergy();
+  _energyMillis = millis();
+
+  setPin(TDIO_STATE_ON);
+ 
+  _startMillis = millis();      
+  currentOnStartDateTime = _timeNow;
+  sensorState = TDIO_STATE_ON; 
+  intervalMillis = timer;
+   
+  #if TDIO_DEBUG
+    printStateChangeInfo();
+  #endif
+  
+}
+
+
+//--------------------------------------------------------
+void TimedDigitalOutput::setOff(void) {
+
+  recordEnergy();
+  setPin(TDIO_STATE_OFF);
+
+  currentOnDuration = 0;
+  currentOnStartDateTime = 0;
+  sensorState = TDIO_STATE_OFF;
+  #if TDIO_DEBUG
+    printStateChangeInfo();
+  #endif  
+    
+}
+
+//--------------------------------------------------------
+void TimedDigitalOutput::setPin(uint8_t state) {
+      
+  if ((sensorLogic == TDIO_LOGIC_POSITIVE && state == TDIO_STATE_ON)  || 
+       (sensorLogic == TDIO_LOGIC_NEGATIVE && state == TDIO_STATE_OFF)) {
+     digitalWrite(sensorPin, HIGH);
+  
+  } else { 
+    digitalWrite(sensorPin, LOW);
+    
+  }   
+    
+}
+
+//--------------------------------------------------------
+void TimedDigitalOutput::checkTimer(void) {
+
+  uint32_t millisPassed;
+
+  recordEnergy();
+
+  if (intervalMillis > 0) {
+    millisPassed = millis() - _startMillis;
+    currentOnDuration = millisPassed;
+    if (millisPassed >= intervalMillis) {
+      setOff();
+      intervalMillis = 0;
+    }  
+  }    
+  
+}
+
+
+//--------------------------------------------------------
+// Adds the energy consumed since the previous call, while the output is ON
+void TimedDigitalOutput::recordEnergy(void) {
+
+  if (sensorState != TDIO_STATE_ON || ratedPower == 0)
+    return;
+  uint32_t currentMillis = millis();
+  totalEnergy += tdioEnergy(currentMillis - _energyMillis, ratedPower, &_energyRemainder);
+  _energyMillis = currentMillis;
+}
+
+//--------------------------------------------------------
+void TimedDigitalOutput::printStateChangeInfo(void) {
+
+  Serial.print(F("***** "));
+  printHumanTime(now());
+  Serial.print(F(" Sensor '")); Serial.print(sensorName);
+  Serial.print(F("' State of pin ")); Serial.print(sensorPin);
+  Serial.print(F(" changed to "));
+  if (sensorState == TDIO_STATE_ON)
+    Serial.println(F("ON"));
+  else
+    Serial.println(F("OFF"));  
+ 
+} 
+
+//--------------------------------------------------------
+// Check pin validity
+boolean TimedDigitalOutput::pinValid(uint8_t mypin) {
+
+  // You may designate specific pins to be used as outputs, referencing pins_arduino.h
+/*
+  if (mypin >= 4 && mypin <= 8) 
+    return true;
+  else
+    return false;
+*/
+  return true;   
+}
+
+//--------------------------------------------------------
+// Registers an output in a free slot of the array and calls its begin().
+// Returns the output, or NULL if there is no free slot or begin() fails
+TimedDigitalOutput *OutputSensorArray::add(const char *name, uint8_t pinCode, uint8_t logic) {
+
+  adoptStarted();
+  int slot = _pool.peek();
+  if (slot < 0)
+    return NULL;
+  if (tdo[slot].begin(name, pinCode, logic) != 0)
+    return NULL;
+  _pool.allocate();
+  ++_startedSeen;
+  return &tdo[slot];
+}
+
+//--------------------------------------------------------
+// Registers the outputs started with their own begin(), e.g. tdo[0].begin(...).
+// tdo[] is only checked after such a begin()
+void OutputSensorArray::adoptStarted(void) {
+
+  if (_startedSeen == TimedDigitalOutput::_startedCount)
+    return;
+  _startedSeen = TimedDigitalOutput::_startedCount;
+  for (uint16_t i = 0; i < TDO_MAX_SENSORS; i++)
+    if (tdo[i]._active && !_pool.inUse(i))
+      _pool.allocate(i);
+}
+
+//--------------------------------------------------------
+// True if tdo[slot] is registered
+boolean OutputSensorArray::isRegistered(uint16_t slot) {
+
+  adoptStarted();
+  return _pool.inUse(slot);
+}
+
+//--------------------------------------------------------
+// Unregisters an output added with add() or begin(). The pin is set to OFF
+int OutputSensorArray::remove(TimedDigitalOutput *s) {
+
+  adoptStarted();
+  uint16_t slot = s - tdo;
+  if (s < tdo || !_pool.inUse(slot))
+    return -1;
+  s->setOff();
+  s->intervalMillis = 0;
+  s->_active = false;
+  _pool.release(slot);
+  return 0;
+}
+
+//--------------------------------------------------------
+// Number of registered outputs
+uint16_t OutputSensorArray::count(void) {
+
+  adoptStarted();
+  return _pool.count();
+}
+
+//--------------------------------------------------------
+// The n-th registered output, 0 <= n < count()
+TimedDigitalOutput *OutputSensorArray::sensor(uint16_t n) {
+
+  return &tdo[_pool.slot(n)];
+}
+
+//--------------------------------------------------------
+// Checks the timers of all registered outputs
+void OutputSensorArray::checkTimers(void) {
+
+  adoptStarted();
+  for (uint16_t n = 0; n < _pool.count(); n++)
+    tdo[_pool.slot(n)].checkTimer();
+}
+
+//--------------------------------------------------------
+static void OutputSensorArray::printSensorData(TimedDigitalOutput *s) {
 
     Serial.print(F("---------- "));
     Serial.print(s->sensorName);
@@ -614,11 +2154,323 @@ static void OutputSensorArray::printSensorData(TimedDigitalOutput *s) {
       
     }
 
+    if (s->ratedPower > 0) {
+      Serial.print(F("Total energy Wh: "));
+      Serial.println(s->totalEnergy);
+    }
+
     Serial.println(F("------------------------------"));
     Serial.println();
   
 }
 
+////////////  Serial protocol ////////////////////////
+
+// States of the frame parser
+#define TDIO_PARSE_START 0
+#define TDIO_PARSE_ADDRESS 1
+#define TDIO_PARSE_COMMAND 2
+#define TDIO_PARSE_LENGTH 3
+#define TDIO_PARSE_PAYLOAD 4
+#define TDIO_PARSE_CRC_LOW 5
+#define TDIO_PARSE_CRC_HIGH 6
+
+// Offset of the reply data in the buffer, after start, address, command, length and status
+#define TDIO_REPLY_DATA 5
+
+//--------------------------------------------------------
+// Little endian conversions of the payload, independent of the byte order of the board
+static uint16_t getUint16(const uint8_t *p) {
+
+  return (uint16_t)p[0] | ((uint16_t)p[1] << 8);
+}
+
+static uint32_t getUint32(const uint8_t *p) {
+
+  return (uint32_t)getUint16(p) | ((uint32_t)getUint16(p + 2) << 16);
+}
+
+static void putUint16(uint8_t *p, uint16_t value) {
+
+  p[0] = value & 0xFF;
+  p[1] = value >> 8;
+}
+
+static void putUint32(uint8_t *p, uint32_t value) {
+
+  putUint16(p, value & 0xFFFF);
+  putUint16(p + 2, value >> 16);
+}
+
+// Class constructor
+TdioProtocol::TdioProtocol() {
+}
+
+/*
+  Must be called once, after the port is opened, e.g. Serial.begin(115200)
+    port: The serial port, e.g. Serial
+    address: The address of this device on the bus
+    inputs, outputs: The sensor arrays served. Any of them may be NULL
+    txEnablePin: The pin that enables the transmitter of a half duplex (RS-485) transceiver,
+                 or TDIO_PROTOCOL_NO_PIN
+    baud: The speed of the port. With a txEnablePin, it gives the time the transmitter must
+          stay enabled for a reply. If 0, poll() waits with flush() for the last byte only
+*/
+void TdioProtocol::begin(Stream &port, uint8_t address, InputSensorArray *inputs, OutputSensorArray *outputs, 
+                         uint8_t txEnablePin, uint32_t baud) {
+
+  _port = &port;
+  _address = address;
+  _inputs = inputs;
+  _outputs = outputs;
+  _txEnablePin = txEnablePin;
+  _baud = baud;
+  _state = TDIO_PARSE_START;
+  _txPending = false;
+  _txIdle = _port->availableForWrite();
+
+  if (_txEnablePin != TDIO_PROTOCOL_NO_PIN) {
+    pinMode(_txEnablePin, OUTPUT);
+    digitalWrite(_txEnablePin, LOW);
+  }
+}
+
+//--------------------------------------------------------
+// Processes the bytes already received. Returns immediately if there are none.
+void TdioProtocol::poll(void) {
+
+  if (_port == NULL)
+    return;
+
+  // The request waits in the receive buffer until the previous reply is out
+  if (transmitting())
+    return;
+
+  while (_port->available() > 0) {
+    _lastByteMillis = millis();
+    parseByte(_port->read());
+    if (_txPending)
+      return;
+  }
+
+  // A frame that stopped arriving in the middle is discarded.
+  // Only checked when nothing is waiting, so that a late poll() does not discard a good frame
+  if (_state != TDIO_PARSE_START && millis() - _lastByteMillis > TDIO_PROTOCOL_TIMEOUT) {
+    _state = TDIO_PARSE_START;
+    ++framesRejected;
+  }
+}
+
+//--------------------------------------------------------
+// True while a reply is being sent through a half duplex transceiver.
+// The transmitter is disabled once the transmit buffer of the port is empty and,
+// if the baud rate is known, the whole frame had the time to go out.
+// Without the baud rate, flush() waits for the last byte, which is in the shift register
+boolean TdioProtocol::transmitting(void) {
+
+  if (!_txPending)
+    return false;
+  if (_port->availableForWrite() < _txIdle)
+    return true;
+  if (_baud > 0) {
+    if (micros() - _txStartMicros < _txMicros)
+      return true;
+  } else {
+    _port->flush();
+  }
+  digitalWrite(_txEnablePin, LOW);
+  _txPending = false;
+  return false;
+}
+
+//--------------------------------------------------------
+void TdioProtocol::parseByte(uint8_t value) {
+
+  switch (_state) {
+
+    case TDIO_PARSE_START:
+      if (value == TDIO_PROTOCOL_START) {
+        _crc = 0xFFFF;
+        _state = TDIO_PARSE_ADDRESS;
+      }
+      break;
+
+    case TDIO_PARSE_ADDRESS:
+      _frameAddress = value;
+      _crc = tdioCrc16(_crc, &value, 1);
+      _state = TDIO_PARSE_COMMAND;
+      break;
+
+    case TDIO_PARSE_COMMAND:
+      _command = value;
+      _crc = tdioCrc16(_crc, &value, 1);
+      _state = TDIO_PARSE_LENGTH;
+      break;
+
+    case TDIO_PARSE_LENGTH:
+      if (value > TDIO_PROTOCOL_MAX_PAYLOAD) {
+        ++framesRejected;
+        _state = TDIO_PARSE_START;
+        break;
+      }
+      _length = value;
+      _received = 0;
+      _crc = tdioCrc16(_crc, &value, 1);
+      _state = (_length > 0) ? TDIO_PARSE_PAYLOAD : TDIO_PARSE_CRC_LOW;
+      break;
+
+    case TDIO_PARSE_PAYLOAD:
+      _buffer[_received++] = value;
+      _crc = tdioCrc16(_crc, &value, 1);
+      if (_received == _length)
+        _state = TDIO_PARSE_CRC_LOW;
+      break;
+
+    case TDIO_PARSE_CRC_LOW:
+      _frameCrc = value;
+      _state = TDIO_PARSE_CRC_HIGH;
+      break;
+
+    case TDIO_PARSE_CRC_HIGH:
+      _frameCrc |= (uint16_t)value << 8;
+      _state = TDIO_PARSE_START;
+      if (_frameCrc != _crc) {
+        ++framesRejected;
+        break;
+      }
+      // Frames for other devices on the bus are silently ignored
+      if (_frameAddress != _address)
+        break;
+      ++framesReceived;
+      handleFrame();
+      break;
+  }
+}
+
+//--------------------------------------------------------
+// Executes the command of a complete frame and replies.
+// The arguments are read from the buffer before the reply overwrites it
+void TdioProtocol::handleFrame(void) {
+
+  uint8_t *data = _buffer + TDIO_REPLY_DATA;
+  uint16_t slot = (_length >= 2) ? getUint16(_buffer) : 0;
+
+  switch (_command) {
+
+    case TDIO_CMD_GET_SENSOR: {
+      if (_inputs == NULL || _length != 2 || slot >= TDI_MAX_SENSORS || !_inputs->tdi[slot].isActive())
+        break;
+      TimedDigitalInput *s = &_inputs->tdi[slot];
+      putUint16(data, slot);
+      data[2] = s->sensorState;
+      data[3] = s->currentMonth;
+      data[4] = s->currentDay;
+      putUint32(data + 5, s->currentOnDuration);
+      putUint32(data + 9, s->todayOnCounter);
+      putUint32(data + 13, s->todayOnDuration);
+      putUint32(data + 17, s->currentMonthOnDuration);
+      reply(TDIO_STATUS_OK, 21);
+      return;
+    }
+
+    case TDIO_CMD_GET_MONTHLY: {
+      uint8_t eepromBlock = _buffer[0];
+      if (_length != 1 || eepromBlock >= TDI_MAX_SENSORS)
+        break;
+      data[0] = eepromBlock;
+      for (uint8_t i = 0; i < 12; i++) {
+        uint32_t monthly_value;
+        EEPROM.get(EEPROM_OFFSET + (eepromBlock * 12 + i) * sizeof(uint32_t), monthly_value);
+        #if TDIO_STATS
+          ++tdioStats.eepromReads;
+        #endif
+        if (monthly_value == EEPROM_ERASED_VALUE)
+          monthly_value = 0;
+        putUint32(data + 1 + i * sizeof(uint32_t), monthly_value);
+      }
+      reply(TDIO_STATUS_OK, 1 + 12 * sizeof(uint32_t));
+      return;
+    }
+
+    case TDIO_CMD_SET_ON: {
+      if (_outputs == NULL || _length != 6 || !_outputs->isRegistered(slot))
+        break;
+      _outputs->tdo[slot].setOn(getUint32(_buffer + 2));
+      putUint16(data, slot);
+      reply(TDIO_STATUS_OK, 2);
+      return;
+    }
+
+    case TDIO_CMD_SET_OFF: {
+      if (_outputs == NULL || _length != 2 || !_outputs->isRegistered(slot))
+        break;
+      _outputs->tdo[slot].setOff();
+      _outputs->tdo[slot].intervalMillis = 0;
+      putUint16(data, slot);
+      reply(TDIO_STATUS_OK, 2);
+      return;
+    }
+
+    case TDIO_CMD_RESET_COUNTERS: {
+      if (_inputs == NULL || _length != 2)
+        break;
+      // The EEPROM writes take milliseconds per byte on the AVR. They are left to the 
+      // array, so that the reply goes out at once and the sampling goes on
+      if (slot == TDIO_ALL_SENSORS) {
+        for (uint16_t i = 0; i < TDI_MAX_SENSORS; i++)
+          if (_inputs->tdi[i].isActive())
+            _inputs->tdi[i].resetCounters(true);
+      } else if (slot < TDI_MAX_SENSORS && _inputs->tdi[slot].isActive()) {
+        _inputs->tdi[slot].resetCounters(true);
+      } else {
+        break;
+      }
+      // Otherwise the next restore would bring back the old counters
+      _inputs->saveCheckpointLater();
+      reply(TDIO_STATUS_OK, 0);
+      return;
+    }
+
+    default:
+      reply(TDIO_STATUS_UNKNOWN_COMMAND, 0);
+      return;
+  }
+
+  reply(TDIO_STATUS_BAD_ARGUMENT, 0);
+}
+
+//--------------------------------------------------------
+// Sends the reply frame. The data are already in the buffer after the status byte.
+// The frame fits in the transmit buffer of the port, so write() does not wait.
+// A half duplex transceiver must keep transmitting until the last byte is out,
+// which poll() checks without waiting
+void TdioProtocol::reply(uint8_t status, uint8_t length) {
+
+  _buffer[0] = TDIO_PROTOCOL_START;
+  _buffer[1] = _address;
+  _buffer[2] = _command | TDIO_CMD_REPLY;
+  _buffer[3] = length + 1;
+  _buffer[4] = status;
+  uint16_t crc = tdioCrc16(0xFFFF, _buffer + 1, length + 4);
+  _buffer[TDIO_REPLY_DATA + length] = crc & 0xFF;
+  _buffer[TDIO_REPLY_DATA + length + 1] = crc >> 8;
+  uint8_t frameLength = TDIO_REPLY_DATA + length + 2;
+
+  if (_txEnablePin != TDIO_PROTOCOL_NO_PIN) {
+    // The transmit buffer is empty when its free space is the largest seen
+    int space = _port->availableForWrite();
+    if (space > _txIdle)
+      _txIdle = space;
+    digitalWrite(_txEnablePin, HIGH);
+    _txPending = true;
+    _txStartMicros = micros();
+    // 10 bits per byte: start, 8 data bits, stop
+    _txMicros = (_baud > 0) ? (uint32_t)frameLength * 10000000UL / _baud : 0;
+  }
+  _port->write(_buffer, frameLength);
+}
+
+
 /////////////////////////////////////////////////////////////
 // Some useful functions outside classes
 
@@ -648,3 +2500,49 @@ void print2Digits(int digits) {
   Serial.print(digits);
 }
 
+//--------------------------------------------------------
+// Energy in Wh of a device of watts power, running for millisPassed.
+// Uses integer arithmetic only. The energy below 1 Wh is carried in remainder (in W*ms),
+// so nothing is lost between calls. The division runs only when a whole Wh is completed.
+// Long periods are processed in chunks, so that the product never overflows uint32_t
+uint32_t tdioEnergy(uint32_t millisPassed, uint16_t watts, uint32_t *remainder) {
+
+  uint32_t energy = 0;
+
+  while (millisPassed > 0) {
+    uint32_t chunk = (millisPassed > TDIO_ENERGY_CHUNK) ? TDIO_ENERGY_CHUNK : millisPassed;
+    millisPassed -= chunk;
+    *remainder += chunk * watts;
+    if (*remainder >= TDIO_WMS_PER_WH) {
+      uint32_t wh = *remainder / TDIO_WMS_PER_WH;
+      energy += wh;
+      *remainder -= wh * TDIO_WMS_PER_WH;
+    }
+  }
+  return energy;
+}
+
+//--------------------------------------------------------
+// Cost of energyWh at pricePerKWh, in the units of the price (e.g. cents).
+// Split in kWh and Wh, so that it does not overflow for a month of a multi-kW device
+uint32_t tdioEnergyCost(uint32_t energyWh, uint16_t pricePerKWh) {
+
+  return (energyWh / 1000) * pricePerKWh + ((energyWh % 1000) * pricePerKWh) / 1000;
+}
+
+//--------------------------------------------------------
+// CRC-16/CCITT of a block of bytes. Start with crc = 0xFFFF, 
+// or with the result of a previous call to continue over more bytes.
+uint16_t tdioCrc16(uint16_t crc, const uint8_t *data, uint16_t length) {
+
+  while (length--) {
+    crc ^= (uint16_t)(*data++) << 8;
+    for (uint8_t bit = 0; bit < 8; bit++) {
+      if (crc & 0x8000)
+        crc = (crc << 1) ^ 0x1021;
+      else
+        crc <<= 1;
+    }
+  }
+  return crc;
+}
@@ -41,18 +41,33 @@
 #include <WProgram.h> 
 #endif
 
+// The settings below are wrapped in #ifndef, so that they can also be given
+// as compiler flags, e.g. -DTDI_MAX_SENSORS=64, without editing this file.
+
 // Set TDIO_DEBUG 0 for production environment.
 // Allows the printing of sensor information in a sketch debugging phase
+#ifndef TDIO_DEBUG
 #define TDIO_DEBUG 1
+#endif
+
+// Set TDIO_STATS 1 to count the EEPROM operations performed by the library.
+// Used by the host benchmark, see test/bench. Costs a few bytes of RAM, so keep it 0 in production.
+#ifndef TDIO_STATS
+#define TDIO_STATS 0
+#endif
 
 // The maximum number of input sensors that can be defined.
 // The library instantiates all these sensors, which are configured later with begin()
 // but occupy memory regardless if a sensor is used or not. 
 // Use the lowest possible value, in order to save memory.
+#ifndef TDI_MAX_SENSORS
 #define TDI_MAX_SENSORS 4
+#endif
 
 // The maximum number of output sensors that can be defined.
+#ifndef TDO_MAX_SENSORS
 #define TDO_MAX_SENSORS 4
+#endif
 
 // Starting location of the storage space within the EEPROM.
 // The data occupy (4 bytes per month * 12 months) * TDI_MAX_SENSORS
@@ -71,9 +86,157 @@
 // If the user tries to set a lower value, the value will be overriden to this minimum
 #define EEPROM_MINIMUM_RECORDING_INTERVAL 3600 * 6 // 6 hours
 
+// Value of a factory-fresh (erased) EEPROM location read as uint32_t
+#define EEPROM_ERASED_VALUE 0xFFFFFFFF
+
+// Starting location of the checkpoint journal within the EEPROM, by default right after the monthly data.
+// The journal has two slots, written alternately. Each slot occupies
+// sizeof(TdioCheckpointHeader) + sizeof(TdioCheckpointRecord) * TDI_MAX_SENSORS bytes (105 bytes for 4 sensors on AVR)
+#ifndef TDIO_CHECKPOINT_OFFSET
+#define TDIO_CHECKPOINT_OFFSET (EEPROM_OFFSET + TDI_MAX_SENSORS * 12 * sizeof(uint32_t))
+#endif
+
+// Changes whenever the layout of the checkpoint changes, so that old checkpoints are ignored
+#define TDIO_CHECKPOINT_VERSION 3
+
+// Set TDIO_HISTORY 0 to remove the compressed history log. 
+// The history keeps the monthly on-durations of all sensors, tagged with the year, 
+// for several years, and then drops the oldest records. It occupies TDIO_HISTORY_SIZE bytes of EEPROM at TDIO_HISTORY_OFFSET, 
+// by default right after the checkpoint journal, and 10 bytes of RAM per sensor (14 with TDIO_HISTORY_DAILY).
+// The monthly blocks, the checkpoints and the default history fit in the 1 KB EEPROM of an ATmega328 
+// with up to 5 sensors. With more sensors, or on an ATmega168 (512 bytes), reduce TDIO_HISTORY_SIZE 
+// or set TDIO_HISTORY 0. The build stops if the layout does not fit in the EEPROM (E2END).
+#ifndef TDIO_HISTORY
+#define TDIO_HISTORY 1
+#endif
+
+#ifndef TDIO_HISTORY_OFFSET
+#define TDIO_HISTORY_OFFSET (TDIO_CHECKPOINT_OFFSET + 2 * (sizeof(TdioCheckpointHeader) + TDI_MAX_SENSORS * sizeof(TdioCheckpointRecord)))
+#endif
+
+#ifndef TDIO_HISTORY_SIZE
+#define TDIO_HISTORY_SIZE 512
+#endif
+
+// The log is a ring of pages. When all pages are in use, the oldest page is dropped.
+// TDIO_HISTORY_SIZE must be a multiple of the page size, of at least 2 pages
+#ifndef TDIO_HISTORY_PAGE
+#define TDIO_HISTORY_PAGE 64
+#endif
+#define TDIO_HISTORY_PAGES (TDIO_HISTORY_SIZE / TDIO_HISTORY_PAGE)
+#if TDIO_HISTORY && (TDIO_HISTORY_SIZE % TDIO_HISTORY_PAGE != 0 || TDIO_HISTORY_PAGES < 2 || TDIO_HISTORY_PAGES > 255)
+  #error "TDIO_HISTORY_SIZE must be a multiple of TDIO_HISTORY_PAGE, of 2 to 255 pages"
+#endif
+
+// Resolution of the durations in the history, in seconds. 60 keeps minutes, 1 keeps seconds
+#ifndef TDIO_HISTORY_RESOLUTION
+#define TDIO_HISTORY_RESOLUTION 60
+#endif
+
+// Set TDIO_HISTORY_DAILY 1 to log also the on-duration of every day. Needs a larger TDIO_HISTORY_SIZE
+#ifndef TDIO_HISTORY_DAILY
+#define TDIO_HISTORY_DAILY 0
+#endif
+
+// Record types of the history log. A monthly record carries the month (1-12) in its low 4 bits.
+// TDIO_HISTORY_MONTH_ENERGY is a monthly record that carries also the energy of the month.
+// TDIO_HISTORY_END also marks a page that is not in use, in place of its sequence number
+#define TDIO_HISTORY_YEAR 0x01
+#define TDIO_HISTORY_DAY 0x02
+#define TDIO_HISTORY_MONTH 0x10
+#define TDIO_HISTORY_MONTH_ENERGY 0x20
+#define TDIO_HISTORY_END 0xFF
+
+// Priority classes of input sensors. The class sets how often the array samples the sensor.
+// Fast sensors are sampled on every pass, e.g. a burner that switches every few seconds.
+// Slow sensors are sampled on their own period, e.g. a door contact
+#define TDIO_PRIORITY_FAST 0
+#define TDIO_PRIORITY_NORMAL 1
+#define TDIO_PRIORITY_SLOW 2
+
+// Sampling periods of the priority classes in millis
+#define TDIO_PERIOD_FAST 0
+#define TDIO_PERIOD_NORMAL 100
+#define TDIO_PERIOD_SLOW 1000
+
+// After a change of state, a sensor is sampled on every pass for this long, in millis,
+// so that a quick sequence of changes is followed closely
+#define TDIO_BOOST_DURATION 5000
+
+// A sample is late when the time since the previous sample of the sensor exceeds its
+// sampling period by more than this, in millis. See InputSensorArray::maxSampleLateness
+#ifndef TDIO_MAX_SAMPLE_LATENESS
+#define TDIO_MAX_SAMPLE_LATENESS 100
+#endif
+
+// Use the pin change flags of AVR boards to detect pulses missed between two
+// passes of InputSensorArray::readSensors(). See enableEdgeFlags()
+#ifndef TDIO_EDGE_FLAGS
+#define TDIO_EDGE_FLAGS 0
+#endif
+
+// Sampling on another core or task, and accounting in loop(). 
+// See InputSensorArray::captureSensors(). On by default on the dual core boards
+#ifndef TDIO_SAMPLER
+  #if defined(ARDUINO_ARCH_ESP32) || defined(ARDUINO_ARCH_RP2040)
+    #define TDIO_SAMPLER 1
+  #else
+    #define TDIO_SAMPLER 0
+  #endif
+#endif
+
+// Longest wait of InputSensorArray::accountSensors() for the sampler to publish, in micros
+#ifndef TDIO_SAMPLER_WAIT
+#define TDIO_SAMPLER_WAIT 1000
+#endif
+
+// Orders the memory accesses of the sampler and of the accounting, across cores
+#define TDIO_MEMORY_BARRIER() __sync_synchronize()
+
+// EEPROM writes of a sensor left pending by InputSensorArray::scan()
+#define TDIO_PENDING_CURRENT 0x01 // Periodic write of the current month
+#define TDIO_PENDING_CLOSED 0x02  // Total of the month that just closed
+#define TDIO_PENDING_NEXT 0x04    // Zero to the month after the current one
+#define TDIO_PENDING_HISTORY_MONTH 0x08 // History record of the month that closed
+#define TDIO_PENDING_HISTORY_DAY 0x10   // History record of the day that closed
+#define TDIO_PENDING_QUEUED 0x80  // The sensor is in the queue of the array
+
+// Energy accounting, see tdioEnergy()
+// 1 Wh = 3600 * 1000 W*ms
+#define TDIO_WMS_PER_WH 3600000UL
+// Longest period in millis multiplied by the power at once. 
+// 60000 * 65535 W plus a remainder below 1 Wh fits in uint32_t
+#define TDIO_ENERGY_CHUNK 60000UL
+
 // Maximum size of the sensor name in bytes
 #define MAX_SENSOR_NAME 10
 
+// Binary protocol over a serial port, see TdioProtocol
+// Maximum payload of a frame in bytes. The largest reply is a monthly block: 1 + 1 + 12 * 4 bytes
+#define TDIO_PROTOCOL_MAX_PAYLOAD 56
+// A frame whose bytes are further apart than this, in millis, is discarded
+#define TDIO_PROTOCOL_TIMEOUT 20
+// First byte of every frame
+#define TDIO_PROTOCOL_START 0x7E
+// Value of txEnablePin when the transceiver switches direction by itself
+#define TDIO_PROTOCOL_NO_PIN 255
+
+// Protocol commands. The reply carries the command with the high bit set
+#define TDIO_CMD_GET_SENSOR 0x01
+#define TDIO_CMD_GET_MONTHLY 0x02
+#define TDIO_CMD_SET_ON 0x03
+#define TDIO_CMD_SET_OFF 0x04
+#define TDIO_CMD_RESET_COUNTERS 0x05
+#define TDIO_CMD_REPLY 0x80
+
+// First byte of the payload of every reply
+#define TDIO_STATUS_OK 0
+#define TDIO_STATUS_UNKNOWN_COMMAND 1
+#define TDIO_STATUS_BAD_ARGUMENT 2
+
+// Sensor number that addresses all sensors in TDIO_CMD_RESET_COUNTERS
+#define TDIO_ALL_SENSORS 0xFFFF
+
 // The logic of the sensor. 
 // TDIO_LOGIC_POSITIVE means ON is logic level 1
 // TDIO_LOGIC_NEGATIVE means ON is logic level 0
@@ -99,6 +262,198 @@
 #include <DS1307RTC.h>  // a basic DS1307 library that returns time as a time_t
 
 
+////////// Statistics /////////
+
+#if TDIO_STATS
+// Counters of EEPROM operations, incremented by every EEPROM.get() and EEPROM.put() 
+// of the library. The sketch may reset them at will.
+struct TdioStats {
+  uint32_t eepromReads;
+  uint32_t eepromWrites;
+};
+
+extern TdioStats tdioStats;
+#endif
+
+////////// Checkpoint journal /////////
+
+// A checkpoint slot starts with a header, followed by one record per sensor.
+// The CRC covers the header fields before it and all the records.
+// The header is written last, so a slot is valid only if it was written completely.
+// The time of the checkpoint gives the year of the month of each record.
+struct TdioCheckpointHeader {
+  uint32_t sequence;
+  uint32_t time;
+  uint8_t version;
+  uint16_t count;
+  uint16_t crc;
+};
+
+struct TdioCheckpointRecord {
+  uint8_t eepromBlock;
+  uint8_t month;
+  uint8_t day;
+  uint32_t monthOnDuration;
+  uint32_t todayOnDuration;
+  uint32_t todayOnCounter;
+  uint32_t monthEnergy;
+  uint32_t todayEnergy;
+};
+
+uint16_t tdioCrc16(uint16_t crc, const uint8_t *data, uint16_t length);
+
+////////// Energy /////////
+
+uint32_t tdioEnergy(uint32_t millisPassed, uint16_t watts, uint32_t *remainder);
+uint32_t tdioEnergyCost(uint32_t energyWh, uint16_t pricePerKWh);
+
+////////// Array initialization /////////
+
+// One entry of the table given to InputSensorArray::begin().
+// The fields have the meaning of the arguments of TimedDigitalInput::begin()
+struct TdiDescriptor {
+  const char *name;
+  uint8_t pin;
+  uint8_t logic;
+  boolean pullup;
+  uint8_t eepromBlock;
+};
+
+////////// History /////////
+
+// One duration record of the history, as given to the callback of InputSensorArray::readHistory()
+struct TdioHistoryEntry {
+  uint16_t year;
+  uint8_t month;
+  uint8_t day;          // 0 for a monthly record
+  uint8_t eepromBlock;
+  uint32_t onDuration;  // in millis, truncated to the resolution of the history
+  uint32_t energy;      // in Wh, 0 for a daily record or a sensor without ratedPower
+};
+
+typedef void (*TdioHistoryCallback)(const TdioHistoryEntry *entry);
+
+////////// Sensor registry /////////
+
+// Type of the slot numbers of the arrays. One byte is enough for up to 255 sensors
+#if TDI_MAX_SENSORS > 255
+typedef uint16_t tdi_index_t;
+#else
+typedef uint8_t tdi_index_t;
+#endif
+
+#if TDO_MAX_SENSORS > 255
+typedef uint16_t tdo_index_t;
+#else
+typedef uint8_t tdo_index_t;
+#endif
+
+#if TDIO_SAMPLER
+////////// Sampler /////////
+
+// Sequence number of the published snapshot. Its reads and writes must be atomic,
+// which is one byte on AVR
+#if defined(__AVR__)
+typedef uint8_t tdio_seq_t;
+#else
+typedef uint32_t tdio_seq_t;
+#endif
+
+// Measurements of InputSensorArray::captureSensors(), indexed by the slot of the sensor.
+// The counters run since the start and wrap around. The accounting uses their
+// differences between two snapshots, so a slow accounting loses nothing
+struct TdioSnapshot {
+  uint32_t sampleMillis;                         // Time of the last capture
+  uint32_t onMillis[TDI_MAX_SENSORS];            // ON time of each sensor
+  uint32_t onEdges[TDI_MAX_SENSORS];             // Times each sensor came ON
+  uint8_t states[(TDI_MAX_SENSORS + 7) / 8];     // Current state of each sensor, one bit per slot
+};
+#endif
+
+//--------------------------------------------------------
+// Keeps track of which of the N slots of an array are in use, without using the heap.
+// Free slots are kept in a stack, active slots in a list, and each active slot
+// knows its position in the list. Allocating and releasing a slot take constant time,
+// and the active slots can be iterated without visiting the free ones.
+template <typename T, uint16_t N>
+class TdioSlotPool {
+
+  private:
+    T _free[N];
+    T _active[N];
+    T _position[N];
+    uint16_t _freeCount;
+    uint16_t _activeCount;
+
+  public:
+    TdioSlotPool(void) { 
+      clear(); 
+    }
+
+    // Releases all slots. Slot 0 is the next to be allocated, then slot 1 etc.
+    void clear(void) {
+      _activeCount = 0;
+      _freeCount = N;
+      for (uint16_t i = 0; i < N; i++) {
+        _free[i] = N - 1 - i;
+        _position[i] = 0;
+      }
+    }
+
+    // The slot that the next allocate() will return, or -1 if all slots are in use
+    int peek(void) const {
+      return _freeCount > 0 ? _free[_freeCount - 1] : -1;
+    }
+
+    int allocate(void) {
+      if (_freeCount == 0)
+        return -1;
+      T slot = _free[--_freeCount];
+      _position[slot] = _activeCount;
+      _active[_activeCount++] = slot;
+      return slot;
+    }
+
+    // Allocates a given slot, or returns -1 if it is not free
+    int allocate(uint16_t slot) {
+      for (uint16_t i = 0; i < _freeCount; i++) {
+        if (_free[i] != slot)
+          continue;
+        memmove(_free + i, _free + i + 1, (_freeCount - i - 1) * sizeof(T));
+        --_freeCount;
+        _position[slot] = _activeCount;
+        _active[_activeCount++] = slot;
+        return slot;
+      }
+      return -1;
+    }
+
+    // The last active slot takes the position of the released one
+    boolean release(uint16_t slot) {
+      if (!inUse(slot))
+        return false;
+      T last = _active[--_activeCount];
+      _active[_position[slot]] = last;
+      _position[last] = _position[slot];
+      _free[_freeCount++] = slot;
+      return true;
+    }
+
+    boolean inUse(uint16_t slot) const {
+      return slot < N && _position[slot] < _activeCount && _active[_position[slot]] == slot;
+    }
+
+    // Number of active slots
+    uint16_t count(void) const {
+      return _activeCount;
+    }
+
+    // The n-th active slot, 0 <= n < count()
+    uint16_t slot(uint16_t n) const {
+      return _active[n];
+    }
+};
+
 ////////// Class Definitions/////////
 
 class TimedDigitalInput {
@@ -106,7 +461,15 @@ class TimedDigitalInput {
   // Durations are stored in millis.
   // DateTimes are stored as unix seconds
   
+  // The array reads and restores the counters of its sensors in bulk
+  friend class InputSensorArray;
+
   private:
+    // Set by a successful begin()
+    boolean _active = false;
+    // Number of successful begin() calls of all sensors, so that an array 
+    // notices sensors started with tdi[i].begin(), see InputSensorArray::adoptStarted()
+    static uint16_t _startedCount;
     uint8_t _previousState = TDIO_STATE_OFF;
     uint32_t _previousMillis = 0; 
     time_t _timeNow; // current unix time
@@ -114,15 +477,50 @@ class TimedDigitalInput {
     uint32_t _EEPROMRecordingInterval;   
     // Variable to store the time when data were written lastly to EEPROM
     uint32_t _previousEEPROMWriteMillis;
+    // EEPROM writes deferred by sample(), see TDIO_PENDING_*
+    uint8_t _pendingStores = 0;
+    // When the sensor was last sampled and last changed state, for sampleDue()
+    uint32_t _lastSampleMillis = 0;
+    uint32_t _lastChangeMillis = 0;
+    // Energy below 1 Wh not yet added to the totals, in W*ms
+    uint32_t _energyRemainder = 0;
+    // The month that closed last and its totals, until written to EEPROM and the history
+    uint8_t _closedMonth;
+    uint32_t _closedMonthOnDuration;
+    uint32_t _closedMonthEnergy;
+    #if TDIO_HISTORY && TDIO_HISTORY_DAILY
+      // The day that closed last and its total, until logged in the history
+      uint8_t _closedDay;
+      uint8_t _closedDayMonth;
+      uint32_t _closedDayOnDuration;
+    #endif
+    #if TDIO_SAMPLER
+      // Counters of the sampler already added to the durations, see account()
+      uint32_t _accountedOnMillis = 0;
+      uint32_t _accountedOnEdges = 0;
+    #endif
         
     //////////////////////////////////////////////////////////////////
     // Private Functions
     //////////////////////////////////////////////////////////////////
     void printStateChangeInfo(void);
+    int configure(const char *name, uint8_t pinCode, uint8_t logic, boolean pullup, uint8_t eepromBlock);
+    boolean configValid(uint8_t pinCode, uint8_t eepromBlock);
+    void initCounters(uint8_t thisMonth, uint8_t today, uint32_t monthOnDuration);
+    void sample(boolean deferStores);
+    #if TDIO_SAMPLER
+      void account(uint8_t state, uint32_t onMillis, uint32_t onEdges, boolean deferStores);
+    #endif
+    void updateCalendar(boolean deferStores);
+    boolean sampleDue(uint32_t currentMillis);
+    void flushPendingStores(void);
+    uint8_t nextMonthOf(uint8_t thisMonth);
     void setState(uint8_t value); 
     void toggleStateOn(void);
     void toggleStateOff(void);    
     void recordUpToNow(void);
+    void recordUpTo(uint32_t currentMillis);
+    void addOnDuration(uint32_t millisPassed);
     void storeEEPROM(uint8_t month, uint32_t value);
     uint32_t readEEPROM(uint8_t month);
     boolean pinValid(uint8_t mypin);
@@ -167,6 +565,24 @@ class TimedDigitalInput {
     // Time in unixtime when the pin started reporting state ON
     time_t currentOnStartDateTime;
 
+    // Rated power of the monitored device in watts. 0 disables the energy accounting
+    uint16_t ratedPower = 0;
+
+    // Energy consumed today and during the current month in Wh, based on ratedPower
+    uint32_t todayEnergy;
+    uint32_t currentMonthEnergy;
+
+    // Priority class and sampling period in millis, used by readSensors() and scan() of the array.
+    // 0 means sampling on every pass. Set both with setPriority(), or the period directly
+    uint8_t priority = TDIO_PRIORITY_FAST;
+    uint16_t samplePeriod = TDIO_PERIOD_FAST;
+
+    // Late samples of this sensor, and those of them that found the sensor in the 
+    // same state as before. During such a gap a full pulse may have been missed, 
+    // or an OFF period was counted as ON. Counted by the array, see maxSampleLateness
+    uint16_t lateSamples = 0;
+    uint16_t possibleMissedPulses = 0;
+
     //////////////////////////////////////////////////////////////////
     // Public Functions
     //////////////////////////////////////////////////////////////////
@@ -174,6 +590,9 @@ class TimedDigitalInput {
     int begin(const char *name, uint8_t a_pin, uint8_t sensor_logic, boolean pullup, uint8_t eepromBlock);
     void readSensor(void); 
     void setEEPROMRecordingInterval(uint32_t interval);
+    void setPriority(uint8_t priorityClass);
+    void resetCounters(boolean deferStores = false);
+    boolean isActive(void) { return _active; }
  
 };
 
@@ -184,11 +603,154 @@ class TimedDigitalInput {
 // It also contains some useful functions which would
 // occupy a lot of memory space if instantiated at the 
 // TimedDigitalInput class. Here, they are defined only once.
+// Sensors can also be registered at runtime with add() and 
+// unregistered with remove(). readSensors() reads only 
+// the registered sensors. A sensor started with its own begin(),
+// e.g. s.tdi[0].begin(...), is registered on the next call of the array.
 
 class InputSensorArray {
 
+  private:
+    // Slots of tdi[] registered with add() or begin()
+    TdioSlotPool<tdi_index_t, TDI_MAX_SENSORS> _pool;
+
+    // Value of TimedDigitalInput::_startedCount when tdi[] was last checked by adoptStarted()
+    uint16_t _startedSeen = 0;
+
+    // Position of scan() in the list of registered sensors and start of its current round.
+    // The first round starts at the first call
+    uint16_t _scanPosition = 0;
+    boolean _roundStarted = false;
+    uint32_t _roundStartMicros = 0;
+    // Smoothed time of scan() per sensor read and between two calls, in micros, 
+    // to tell in advance whether stopping would exceed maxStalenessMicros
+    uint32_t _scanSensorMicros = 0;
+    uint32_t _scanGapMicros = 0;
+    uint32_t _scanEndMicros = 0;
+
+    // Sensors with EEPROM writes deferred by scan(), oldest first
+    tdi_index_t _pendingQueue[TDI_MAX_SENSORS];
+    uint16_t _pendingHead = 0;
+    uint16_t _pendingCount = 0;
+
+    // Sequence number and slot of the newest checkpoint in EEPROM
+    uint32_t _checkpointSequence = 0;
+    uint8_t _checkpointSlot = 1;
+    // Set by saveCheckpointLater(), cleared by saveCheckpoint()
+    boolean _checkpointPending = false;
+
+    #if TDIO_HISTORY
+      // Page being written, its sequence number, the end of its records and the number 
+      // of pages in use. Year and resolution of the last year record, and the last 
+      // monthly (and daily) duration of each EEPROM block in the page, in units of the resolution,
+      // and its last monthly energy. The newest month logged for each EEPROM block, as year * 12 + month - 1
+      boolean _historyOpen = false;
+      uint8_t _historyPage = 0;
+      uint8_t _historySequence = 0;
+      uint8_t _historyPages = 0;
+      uint16_t _historyEnd = 0;
+      uint16_t _historyYear = 0;
+      uint16_t _historyResolution = 0;
+      uint32_t _historyMonthBase[TDI_MAX_SENSORS];
+      uint32_t _historyEnergyBase[TDI_MAX_SENSORS];
+      uint16_t _historyLastMonth[TDI_MAX_SENSORS];
+      #if TDIO_HISTORY_DAILY
+        uint32_t _historyDayBase[TDI_MAX_SENSORS];
+      #endif
+
+      int historyDecode(TdioHistoryCallback callback);
+      int historyDecodePage(uint8_t page, TdioHistoryCallback callback);
+      void historyStartPage(uint16_t year);
+      void historyResetBases(uint16_t year, uint16_t resolution);
+      void historyAppend(uint8_t type, uint8_t eepromBlock, uint16_t year, uint8_t month, uint8_t day, uint32_t onDuration, uint32_t energy);
+      void historyWrite(const uint8_t *record, uint8_t length);
+    #endif
+
+    #if TDIO_EDGE_FLAGS && defined(PCIFR)
+      // Pin change groups with registered sensors, and groups where a sensor
+      // changed state during the previous and the current pass of readSensors()
+      uint8_t _edgeGroups = 0;
+      uint8_t _changedGroupsPrevious = 0;
+      uint8_t _changedGroups = 0;
+    #endif
+
+    #if TDIO_SAMPLER
+      // Written only by captureSensors(): its own measurements, the copy it publishes
+      // and the sequence number of the copy, odd while the copy is being written
+      TdioSnapshot _sampled;
+      TdioSnapshot _published;
+      volatile tdio_seq_t _sequence = 0;
+      // Written only by accountSensors(): its copy of the published snapshot
+      TdioSnapshot _accounted;
+    #endif
+
+    boolean sampleSensor(TimedDigitalInput *s, boolean deferStores);
+    void flushSensor(TimedDigitalInput *s);
+    int loadCheckpoint(boolean fresh);
+    int applyCheckpoint(uint8_t slot, const TdioCheckpointHeader *header);
+    boolean checkpointSlotValid(uint8_t slot, const TdioCheckpointHeader *header);
+    void adoptStarted(void);
+    boolean roundOverdue(uint32_t currentMicros, uint32_t budgetMicros);
+    TimedDigitalInput *findByEEPROMBlock(uint8_t eepromBlock, uint16_t hint);
+
   public:
     TimedDigitalInput tdi[TDI_MAX_SENSORS];
+
+    // Duration of the last begin() in micros, from the call to the sensors being ready to read
+    uint32_t coldStartMicros = 0;
+
+    // Settings and measurements of scan(), in micros.
+    // A round is a pass of scan() over all registered sensors, so its duration 
+    // is the maximum age of a sample. maxStalenessMicros is a target, not a guarantee:
+    // scan() finishes the round instead of stopping when the measured costs say the
+    // round would otherwise last longer, see scan(). maxRoundMicros shows the result
+    uint32_t maxStalenessMicros = 0;
+    uint32_t lastRoundMicros = 0;
+    uint32_t maxRoundMicros = 0;
+    uint32_t roundsCompleted = 0;
+
+    // Sampling interval measurements of readSensors() and scan(), in millis.
+    // A sample is late when it comes more than maxSampleLateness after the sampling 
+    // period of the sensor. Late samples that found the sensor in the same state may
+    // hide a missed pulse. Use longestSampleInterval to size the loop budget
+    uint32_t maxSampleLateness = TDIO_MAX_SAMPLE_LATENESS;
+    uint32_t longestSampleInterval = 0;
+    uint32_t lateSamples = 0;
+    uint32_t possibleMissedPulses = 0;
+
+    #if TDIO_EDGE_FLAGS && defined(PCIFR)
+      // Pulses certainly missed, detected through the pin change flags
+      uint32_t missedPulses = 0;
+      void enableEdgeFlags(void);
+    #endif
+
+    int begin(const TdiDescriptor *table, uint16_t count);
+    TimedDigitalInput *add(const char *name, uint8_t pinCode, uint8_t logic, boolean pullup, uint8_t eepromBlock);
+    int remove(TimedDigitalInput *s);
+    uint16_t count(void);
+    TimedDigitalInput *sensor(uint16_t n);
+    void readSensors(void);
+    uint16_t scan(uint32_t budgetMicros);
+    uint16_t scanPosition(void);
+    uint16_t pendingStores(void);
+    void resetSampleCounters(void);
+    #if TDIO_SAMPLER
+      void captureSensors(void);
+      int accountSensors(void);
+    #endif
+    int saveCheckpoint(void);
+    void saveCheckpointLater(void);
+    int restoreCheckpoint(void);
+
+    #if TDIO_HISTORY
+      // Set when the oldest page of the history log was dropped to make room
+      boolean historyWrapped = false;
+      int openHistory(void);
+      int readHistory(TdioHistoryCallback callback);
+      int clearHistory(void);
+      uint16_t historyUsed(void);
+    #endif
+
     static void printSensorData(TimedDigitalInput *s);
     static void printMonthlyActivity(uint8_t eepromBlock);
       
@@ -199,17 +761,28 @@ class TimedDigitalOutput {
 
   // Durations are stored in millis.
   // DateTimes are stored as unix seconds
+
+  // The array registers the outputs started with their own begin()
+  friend class OutputSensorArray;
   
   private:
+    // Set by a successful begin(), cleared by OutputSensorArray::remove()
+    boolean _active = false;
+    // Number of successful begin() calls of all outputs, see OutputSensorArray::adoptStarted()
+    static uint16_t _startedCount;
     
     uint32_t _startMillis = 0;       
     time_t _timeNow; //  unix time
+    // Start of the time not yet accounted in totalEnergy, and the energy below 1 Wh in W*ms
+    uint32_t _energyMillis = 0;
+    uint32_t _energyRemainder = 0;
         
     //////////////////////////////////////////////////////////////////
     // Private Functions
     //////////////////////////////////////////////////////////////////
     void printStateChangeInfo(void);
     void setPin(uint8_t state);
+    void recordEnergy(void);
     boolean pinValid(uint8_t mypin);
        
   public:
@@ -236,6 +809,12 @@ class TimedDigitalOutput {
     // Time interval the sensor will remain ON
     uint32_t intervalMillis = 0;
 
+    // Rated power of the controlled device in watts. 0 disables the energy accounting
+    uint16_t ratedPower = 0;
+
+    // Energy consumed while ON since begin(), in Wh. Updated by checkTimer() and setOff()
+    uint32_t totalEnergy = 0;
+
     //////////////////////////////////////////////////////////////////
     // Public Functions
     //////////////////////////////////////////////////////////////////
@@ -252,15 +831,100 @@ class TimedDigitalOutput {
 // The outputSensorArray class instantiates an array of 
 // TimedDigitalOutput classes, tdo[TDO_MAX_SENSORS]
 // e.g. s.tdo[0], s.tdo[1] etc.
+// As with the inputs, outputs can be registered at runtime 
+// with add() and remove(), and an output started with its own 
+// begin(), e.g. s.tdo[0].begin(...), is registered on the next call of the array.
 
 class OutputSensorArray {
 
+  private:
+    // Slots of tdo[] registered with add()
+    TdioSlotPool<tdo_index_t, TDO_MAX_SENSORS> _pool;
+    uint16_t _startedSeen = 0;
+
+    void adoptStarted(void);
+
   public:
     TimedDigitalOutput tdo[TDO_MAX_SENSORS];
+    TimedDigitalOutput *add(const char *name, uint8_t pinCode, uint8_t logic);
+    int remove(TimedDigitalOutput *s);
+    uint16_t count(void);
+    TimedDigitalOutput *sensor(uint16_t n);
+    // True if tdo[slot] was registered with add() or started with its begin()
+    boolean isRegistered(uint16_t slot);
+    void checkTimers(void);
     static void printSensorData(TimedDigitalOutput *s);
  
 };
 
+//--------------------------------------------------------
+// Request/response protocol over a serial port (e.g. RS-485), for a remote collector.
+// poll() must be called from loop(). It parses the bytes that have already arrived, 
+// one by one, without blocking and without using the heap.
+// With a half duplex transceiver, the transmitter stays enabled after a reply until
+// the frame is out, and a later poll() disables it. Requests are not read in the meantime.
+//
+// Frame: START, address, command, length, payload[length], CRC-16 low byte, CRC-16 high byte
+// The CRC (see tdioCrc16) covers address, command, length and payload.
+// Integers in the payload are little endian. Sensors are given by their slot number (uint16_t).
+//
+//   TDIO_CMD_GET_SENSOR      sensor               -> status, sensor, state, month, day, currentOnDuration, 
+//                                                    todayOnCounter, todayOnDuration, currentMonthOnDuration
+//   TDIO_CMD_GET_MONTHLY     eepromBlock (uint8)  -> status, eepromBlock, 12 monthly durations
+//   TDIO_CMD_SET_ON          output, timer (uint32) -> status, output
+//   TDIO_CMD_SET_OFF         output               -> status, output
+//   TDIO_CMD_RESET_COUNTERS  sensor or TDIO_ALL_SENSORS -> status
+//
+// A reset of the counters is replied at once. Its EEPROM writes and a new checkpoint
+// are performed by the next readSensors(), scan() or accountSensors() of the array.
+// Frames for other addresses are ignored, so many devices can share one bus.
+
+class TdioProtocol {
+
+  private:
+    Stream *_port = NULL;
+    InputSensorArray *_inputs;
+    OutputSensorArray *_outputs;
+    uint8_t _address;
+    uint8_t _txEnablePin;
+    uint32_t _baud;
+
+    // Transmitter state of a half duplex transceiver, see transmitting()
+    boolean _txPending = false;
+    uint32_t _txStartMicros;
+    uint32_t _txMicros;
+    int _txIdle;
+
+    // Parser state
+    uint8_t _state = 0;
+    uint8_t _frameAddress;
+    uint8_t _command;
+    uint8_t _length;
+    uint8_t _received;
+    uint16_t _crc;
+    uint16_t _frameCrc;
+    uint32_t _lastByteMillis;
+
+    // Holds the payload of the request and then the reply frame
+    uint8_t _buffer[TDIO_PROTOCOL_MAX_PAYLOAD + 6];
+
+    void parseByte(uint8_t value);
+    void handleFrame(void);
+    void reply(uint8_t status, uint8_t length);
+    boolean transmitting(void);
+
+  public:
+    // Number of frames answered and of frames discarded because of a bad CRC or length
+    uint32_t framesReceived = 0;
+    uint32_t framesRejected = 0;
+
+    TdioProtocol(void);
+    void begin(Stream &port, uint8_t address, InputSensorArray *inputs, OutputSensorArray *outputs, 
+               uint8_t txEnablePin = TDIO_PROTOCOL_NO_PIN, uint32_t baud = 0);
+    void poll(void);
+
+};
+
 //--------------------------------------------------------
 // General utility functions
 //--------------------------------------------------------
@@ -0,0 +1,175 @@
+/*
+  Test of the registration of the sensors in InputSensorArray and OutputSensorArray
+    - begin(table) with an invalid entry leaves the array as it was
+    - sensors and outputs started with their own begin() are registered by the array,
+      read by readSensors() and saved in the checkpoint
+    - the rounds of scan() are measured from its first call, and maxStalenessMicros
+      makes scan() finish a round that would otherwise last too long
+    - a slot reused by add() does not take a late sample from its previous sensor
+*/
+#include <stdio.h>
+
+#include "HostShim.h"
+#include "TimedDigitalIO.h"
+#include "check.h"
+
+static InputSensorArray in;
+static OutputSensorArray out;
+
+//--------------------------------------------------------
+static void testInvalidTable(void) {
+
+  static const TdiDescriptor good[] = {
+    {"Pump",   8, TDIO_LOGIC_POSITIVE, false, 0},
+    {"Heater", 9, TDIO_LOGIC_POSITIVE, false, 1}
+  };
+  CHECK(in.begin(good, 2) >= 0);
+  CHECK(in.count() == 2);
+
+  // The last entry has an EEPROM block out of range
+  static const TdiDescriptor bad[] = {
+    {"Fan",    10, TDIO_LOGIC_POSITIVE, false, 2},
+    {"Boiler", 11, TDIO_LOGIC_POSITIVE, false, TDI_MAX_SENSORS}
+  };
+  CHECK(in.begin(bad, 2) == -1);
+  CHECK(in.count() == 2);
+  CHECK(strcmp(in.sensor(0)->sensorName, "Pump") == 0);
+  CHECK(in.tdi[0].sensorPin == 8 && in.tdi[0].isActive());
+  CHECK(hostPinMode(10) == INPUT && hostPinMode(11) == INPUT);
+}
+
+//--------------------------------------------------------
+static void testStartedSensors(void) {
+
+  // The table clears the array, then a sensor is started the old way
+  CHECK(in.begin(NULL, 0) == 0);
+  CHECK(in.tdi[2].begin("Pump", 8, TDIO_LOGIC_POSITIVE, false, 2) == 0);
+  CHECK(in.count() == 1);
+  CHECK(in.sensor(0) == &in.tdi[2]);
+
+  // add() does not take the slot of the started sensor
+  TimedDigitalInput *added = in.add("Heater", 9, TDIO_LOGIC_POSITIVE, false, 3);
+  CHECK(added != NULL && added != &in.tdi[2]);
+  CHECK(in.count() == 2);
+
+  hostSetPin(8, HIGH);
+  in.readSensors();
+  hostAdvanceMillis(1000);
+  in.readSensors();
+  CHECK(in.tdi[2].todayOnDuration == 1000);
+
+  // The checkpoint carries the started sensor
+  CHECK(in.saveCheckpoint() == 0);
+  CHECK(in.begin(NULL, 0) == 0);
+  CHECK(in.tdi[2].begin("Pump", 8, TDIO_LOGIC_POSITIVE, false, 2) == 0);
+  CHECK(in.restoreCheckpoint() == 1);
+  CHECK(in.tdi[2].todayOnDuration == 1000);
+
+  CHECK(in.remove(&in.tdi[2]) == 0);
+  CHECK(in.count() == 0);
+
+  // Outputs
+  CHECK(out.tdo[1].begin("Valve", 4, TDIO_LOGIC_POSITIVE) == 0);
+  CHECK(out.isRegistered(1));
+  CHECK(out.count() == 1);
+  out.tdo[1].setOn(500);
+  hostAdvanceMillis(600);
+  out.checkTimers();
+  CHECK(out.tdo[1].sensorState == TDIO_STATE_OFF);
+  CHECK(out.remove(&out.tdo[1]) == 0);
+  CHECK(!out.isRegistered(1));
+}
+
+//--------------------------------------------------------
+// Every read of a pin takes 10 micros
+#define SENSOR_MICROS 10
+
+static uint8_t slowPin(uint8_t pin, uint32_t millis) {
+
+  (void)millis;
+  hostAdvanceMicros(SENSOR_MICROS);
+  return hostPin(pin);
+}
+
+// Calls scan() with budgetMicros, and the rest of loop() taking gapMicros, for a number of rounds.
+// Returns the longest round after the first one
+static uint32_t scanRounds(uint32_t budgetMicros, uint32_t gapMicros, uint32_t rounds) {
+
+  uint32_t longest = 0;
+  uint32_t first = in.roundsCompleted;
+  while (in.roundsCompleted < first + rounds) {
+    uint32_t before = in.roundsCompleted;
+    in.scan(budgetMicros);
+    hostAdvanceMicros(gapMicros);
+    if (in.roundsCompleted != before && in.roundsCompleted > first + 1 && in.lastRoundMicros > longest)
+      longest = in.lastRoundMicros;
+  }
+  return longest;
+}
+
+static void testScanRounds(void) {
+
+  static TdiDescriptor table[TDI_MAX_SENSORS];
+  for (uint16_t i = 0; i < TDI_MAX_SENSORS; i++) {
+    table[i].name = "Sensor";
+    table[i].pin = 20 + i;
+    table[i].logic = TDIO_LOGIC_POSITIVE;
+    table[i].pullup = false;
+    table[i].eepromBlock = i;
+  }
+  CHECK(in.begin(table, TDI_MAX_SENSORS) >= 0);
+  hostSetPinTrace(slowPin);
+
+  // A long time after the start, the first round is measured from the first call
+  hostAdvanceMillis(5000);
+  in.scan(1000000UL);
+  in.scan(1000000UL);
+  CHECK(in.roundsCompleted == 1);
+  CHECK(in.lastRoundMicros <= (TDI_MAX_SENSORS + 1) * SENSOR_MICROS);
+  CHECK(in.maxRoundMicros == in.lastRoundMicros);
+
+  // One sensor per call and 1 milli between the calls: a round takes a milli per sensor
+  uint32_t longest = scanRounds(1, 1000, 5);
+  CHECK(longest >= TDI_MAX_SENSORS * 1000UL);
+
+  // With a target of 1.5 millis, scan() finishes the round before it is overdue
+  in.maxStalenessMicros = 1500;
+  longest = scanRounds(1, 1000, 5);
+  CHECK(longest <= in.maxStalenessMicros);
+
+  hostSetPinTrace(NULL);
+}
+
+//--------------------------------------------------------
+static void testReusedSlot(void) {
+
+  CHECK(in.begin(NULL, 0) == 0);
+  in.resetSampleCounters();
+  TimedDigitalInput *s = in.add("Pump", 8, TDIO_LOGIC_POSITIVE, false, 0);
+  CHECK(s != NULL);
+  in.readSensors();
+  hostAdvanceMillis(10);
+  in.readSensors();
+  CHECK(in.remove(s) == 0);
+
+  // Long after, another sensor takes the same slot. Its first sample has no interval
+  hostAdvanceMillis(10000);
+  CHECK(in.add("Heater", 9, TDIO_LOGIC_POSITIVE, false, 1) == s);
+  in.readSensors();
+  CHECK(in.lateSamples == 0);
+  CHECK(s->lateSamples == 0 && s->possibleMissedPulses == 0);
+  CHECK(in.longestSampleInterval == 10);
+}
+
+int main(void) {
+
+  hostReset();
+
+  testInvalidTable();
+  testStartedSensors();
+  testScanRounds();
+  testReusedSlot();
+
+  printf("ok\n");
+  return 0;
+}
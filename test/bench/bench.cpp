@@ -0,0 +1,236 @@
+/*
+  TimedDigitalIO - Library for timing Digital inputs and Outputs.
+
+  Benchmark of the library hot paths, built on the host against the stand-in
+  of the Arduino APIs (test/shim). See test/CMakeLists.txt.
+
+  Measures, for 4, 64, 256 and 1024 sensors:
+    - nanoseconds per sensor of readSensors()
+    - nanoseconds per output of checkTimers()
+    - EEPROM operations of the library during a simulated normal day and a simulated
+      month-end day, and the bytes of EEPROM really written
+    - RAM bytes per input and output sensor, EEPROM bytes per input sensor
+    - the cold start from a checkpoint: begin() of each sensor followed by
+      restoreCheckpoint(), against begin() of the array with a table. Both paths
+      restore the same checkpoint, so their time and EEPROM bytes read compare
+
+  The inputs follow a synthetic trace: every pin is a square wave of its own period
+  and duty cycle. The simulated days move the clock of the shim, so the periodic
+  EEPROM writes, the day change and the month change happen as on the board.
+
+  Results are printed as CSV lines starting with "bench," so that they can be
+  compared between library versions. The times are those of the host, so compare
+  them only with results of the same machine. The sizes are those of the host
+  compiler, which aligns the structures more than avr-gcc.
+
+  Usage: tdio_bench [maxSensors]
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+
+#include "HostShim.h"
+#include "TimedDigitalIO.h"
+
+#if !TDIO_STATS
+  #error "Compile the benchmark with -DTDIO_STATS=1"
+#endif
+
+// Number of samples of each timing measurement, spread over the passes
+#define BENCH_SAMPLES 2000000UL
+
+// Repetitions of each cold start measurement
+#define COLD_START_RUNS 20
+
+// Step of the clock during the simulated days, in millis
+#define SIM_STEP_MILLIS 1000UL
+
+#define MILLIS_PER_DAY (SECS_PER_DAY * 1000UL)
+
+const uint16_t SENSOR_COUNTS[] = {4, 64, 256, 1024};
+
+static InputSensorArray in;
+static OutputSensorArray out;
+static TdiDescriptor table[TDI_MAX_SENSORS];
+
+static uint16_t lfsr = 0xACE1;
+
+//--------------------------------------------------------
+// 16 bit Galois LFSR, a cheap pseudo random generator for the output timers
+static uint16_t nextRandom(void) {
+
+  uint16_t lsb = lfsr & 1;
+  lfsr >>= 1;
+  if (lsb)
+    lfsr ^= 0xB400;
+  return lfsr;
+}
+
+//--------------------------------------------------------
+// Square wave with a period of 2 to 30 seconds and a duty cycle of 1/8 to 7/8, depending on the pin
+static uint8_t squareWave(uint8_t pin, uint32_t millis) {
+
+  uint32_t period = 2000UL + (pin * 1009UL) % 28000UL;
+  uint32_t on = period * (1 + pin % 7) / 8;
+  return ((millis + pin * 311UL) % period) < on ? HIGH : LOW;
+}
+
+//--------------------------------------------------------
+static uint64_t nanosSince(std::chrono::steady_clock::time_point start) {
+
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+//--------------------------------------------------------
+static uint32_t nsPerReadSensor(uint16_t count) {
+
+  uint32_t passes = BENCH_SAMPLES / count;
+  uint64_t elapsed = 0;
+  for (uint32_t pass = 0; pass < passes; pass++) {
+    hostAdvanceMillis(1);
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    in.readSensors();
+    elapsed += nanosSince(start);
+  }
+  return elapsed / ((uint64_t)passes * count);
+}
+
+//--------------------------------------------------------
+// The outputs whose timer expired are set on again, so that checkTimers() always has work to do
+static uint32_t nsPerCheckTimer(uint16_t count) {
+
+  uint32_t passes = BENCH_SAMPLES / count;
+  uint64_t elapsed = 0;
+  for (uint32_t pass = 0; pass < passes; pass++) {
+    hostAdvanceMillis(1);
+    for (uint16_t n = 0; n < out.count(); n++)
+      if (out.sensor(n)->sensorState == TDIO_STATE_OFF)
+        out.sensor(n)->setOn(1 + nextRandom() % 50);
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    out.checkTimers();
+    elapsed += nanosSince(start);
+  }
+  return elapsed / ((uint64_t)passes * count);
+}
+
+//--------------------------------------------------------
+// EEPROM operations of the library and bytes written, during one simulated day from the current time
+struct DayCost {
+  uint32_t reads;
+  uint32_t writes;
+  uint32_t bytesWritten;
+};
+
+static DayCost simulateDay(void) {
+
+  DayCost cost;
+  tdioStats.eepromReads = 0;
+  tdioStats.eepromWrites = 0;
+  uint32_t bytesBefore = EEPROM.bytesWritten;
+  for (uint32_t t = SIM_STEP_MILLIS; t <= MILLIS_PER_DAY; t += SIM_STEP_MILLIS) {
+    hostAdvanceMillis(SIM_STEP_MILLIS);
+    in.readSensors();
+  }
+  cost.reads = tdioStats.eepromReads;
+  cost.writes = tdioStats.eepromWrites;
+  cost.bytesWritten = EEPROM.bytesWritten - bytesBefore;
+  return cost;
+}
+
+//--------------------------------------------------------
+// Cold start of count sensors, from the checkpoint of all of them in EEPROM
+struct ColdStart {
+  uint32_t ns;
+  uint32_t bytesRead;
+};
+
+static ColdStart coldStart(uint16_t count, boolean perSensor) {
+
+  ColdStart cost;
+  uint64_t elapsed = 0;
+  uint32_t bytesBefore = EEPROM.bytesRead;
+  for (uint8_t run = 0; run < COLD_START_RUNS; run++) {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    if (perSensor) {
+      in.begin(NULL, 0);
+      for (uint16_t i = 0; i < count; i++)
+        in.tdi[i].begin(table[i].name, table[i].pin, table[i].logic, table[i].pullup, table[i].eepromBlock);
+      in.restoreCheckpoint();
+    } else {
+      in.begin(table, count);
+    }
+    elapsed += nanosSince(start);
+  }
+  cost.ns = elapsed / COLD_START_RUNS;
+  cost.bytesRead = (EEPROM.bytesRead - bytesBefore) / COLD_START_RUNS;
+  return cost;
+}
+
+//--------------------------------------------------------
+static void setup(uint16_t count) {
+
+  hostReset();
+  hostSetPinTrace(squareWave);
+
+  // Sensors beyond the 256 EEPROM blocks share the blocks
+  for (uint16_t i = 0; i < count; i++) {
+    table[i].name = "Bench";
+    table[i].pin = 2 + i % 200;
+    table[i].logic = TDIO_LOGIC_POSITIVE;
+    table[i].pullup = false;
+    table[i].eepromBlock = i % 256;
+  }
+  in.begin(table, count);
+
+  while (out.count() > 0)
+    out.remove(out.sensor(0));
+  for (uint16_t i = 0; i < count; i++)
+    out.add("Bench", 2 + i % 200, TDIO_LOGIC_POSITIVE);
+}
+
+int main(int argc, char *argv[]) {
+
+  uint32_t maxSensors = (argc > 1) ? strtoul(argv[1], NULL, 10) : TDI_MAX_SENSORS;
+
+  printf("bench,sensors,ns_per_readSensor,ns_per_checkTimer,eeprom_reads_per_day,eeprom_writes_per_day,"
+         "eeprom_bytes_written_per_day,eeprom_reads_month_end_day,eeprom_writes_month_end_day,"
+         "eeprom_bytes_written_month_end_day,ram_bytes_per_input,ram_bytes_per_output,eeprom_bytes_per_input,"
+         "cold_start_ns_sensor_begin,cold_start_ns_table_begin,"
+         "cold_start_eeprom_bytes_read_sensor_begin,cold_start_eeprom_bytes_read_table_begin\n");
+
+  for (uint8_t k = 0; k < sizeof(SENSOR_COUNTS) / sizeof(SENSOR_COUNTS[0]); k++) {
+
+    uint16_t count = SENSOR_COUNTS[k];
+    if (count > maxSensors || count > TDI_MAX_SENSORS || count > TDO_MAX_SENSORS)
+      break;
+
+    setup(count);
+    uint32_t nsRead = nsPerReadSensor(count);
+    uint32_t nsCheck = nsPerCheckTimer(count);
+
+    // A normal day, from midnight to midnight
+    setTime(0, 0, 0, 15, 11, 2017);
+    in.readSensors();
+    DayCost day = simulateDay();
+
+    // The last day of a month, from noon to noon. The first pass absorbs the jump of the clock
+    setTime(12, 0, 0, 30, 11, 2017);
+    in.readSensors();
+    DayCost monthEnd = simulateDay();
+
+    in.saveCheckpoint();
+    ColdStart sensorBegin = coldStart(count, true);
+    ColdStart tableBegin = coldStart(count, false);
+
+    printf("bench,%u,%u,%u,%u,%u,%u,%u,%u,%u,%u,%u,%u,%u,%u,%u,%u\n",
+           count, nsRead, nsCheck,
+           day.reads, day.writes, day.bytesWritten,
+           monthEnd.reads, monthEnd.writes, monthEnd.bytesWritten,
+           (unsigned)(sizeof(TimedDigitalInput) + (sizeof(InputSensorArray) - sizeof(in.tdi)) / TDI_MAX_SENSORS),
+           (unsigned)(sizeof(TimedDigitalOutput) + (sizeof(OutputSensorArray) - sizeof(out.tdo)) / TDO_MAX_SENSORS),
+           (unsigned)(12 * sizeof(uint32_t) + 2 * sizeof(TdioCheckpointRecord)),
+           sensorBegin.ns, tableBegin.ns, sensorBegin.bytesRead, tableBegin.bytesRead);
+  }
+
+  return 0;
+}
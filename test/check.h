@@ -0,0 +1,18 @@
+/*
+  Assertion of the host tests. Unlike assert(), it is never compiled out
+*/
+#ifndef TDIO_TEST_CHECK_H
+#define TDIO_TEST_CHECK_H
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define CHECK(condition) \
+  do { \
+    if (!(condition)) { \
+      fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+      exit(1); \
+    } \
+  } while (0)
+
+#endif // TDIO_TEST_CHECK_H
@@ -0,0 +1,192 @@
+/*
+  Test of the checkpoint journal of InputSensorArray
+    - the counters of the current month and day are restored after a short outage
+    - a month that closed during the outage gets its total from the checkpoint
+    - a checkpoint of the same month of a previous year is ignored
+    - begin(table) reads the newest slot once, and the monthly block of the current month
+      of each sensor in the same pass
+    - a monthly block written after the checkpoint is not overwritten by the checkpoint
+    - a monthly block left over from a previous year, or torn, is not taken as the month total
+    - begin(table) falls back to the older slot when the newest is damaged
+*/
+#include <stdio.h>
+
+#include "HostShim.h"
+#include "TimedDigitalIO.h"
+#include "check.h"
+
+static InputSensorArray in;
+
+static const TdiDescriptor table[] = {
+  {"Pump",   8, TDIO_LOGIC_POSITIVE, false, 0},
+  {"Heater", 9, TDIO_LOGIC_POSITIVE, false, 1}
+};
+
+static uint32_t monthlyValue(uint8_t eepromBlock, uint8_t month) {
+
+  uint32_t value;
+  EEPROM.get(EEPROM_OFFSET + (eepromBlock * 12 + month - 1) * sizeof(uint32_t), value);
+  return value == EEPROM_ERASED_VALUE ? 0 : value;
+}
+
+// Pump ON for an hour on 2017-11-15 from 12:00, then a checkpoint. The EEPROM is kept
+static void runAndSave(void) {
+
+  hostReset();
+  CHECK(in.begin(table, 2) == 0);
+  hostSetPin(8, HIGH);
+  in.readSensors();
+  hostAdvanceMillis(3600000UL);
+  in.readSensors();
+  CHECK(in.tdi[0].todayOnDuration == 3600000UL);
+  CHECK(in.saveCheckpoint() == 0);
+}
+
+// The power comes back at the given date
+static int restart(uint8_t day, uint8_t month, uint16_t year) {
+
+  hostSetPin(8, LOW);
+  setTime(12, 0, 0, day, month, year);
+  return in.begin(table, 2);
+}
+
+// A second hour ON and a second checkpoint, in the other slot
+static void runAndSaveAgain(void) {
+
+  hostSetPin(8, HIGH);
+  in.readSensors();
+  hostAdvanceMillis(3600000UL);
+  in.readSensors();
+  CHECK(in.tdi[0].todayOnDuration == 2 * 3600000UL);
+  CHECK(in.saveCheckpoint() == 0);
+}
+
+static int slotAddress(uint8_t slot) {
+
+  return TDIO_CHECKPOINT_OFFSET + slot * (sizeof(TdioCheckpointHeader) + TDI_MAX_SENSORS * sizeof(TdioCheckpointRecord));
+}
+
+static void testColdStartReads(void) {
+
+  runAndSave();
+  setTime(13, 0, 0, 15, 11, 2017);
+  uint32_t bytesBefore = EEPROM.bytesRead;
+  CHECK(in.begin(table, 2) == 2);
+  // The two headers, the two records and the monthly value of the current month of both sensors
+  CHECK(EEPROM.bytesRead - bytesBefore == 2 * sizeof(TdioCheckpointHeader) + 2 * sizeof(TdioCheckpointRecord) + 2 * sizeof(uint32_t));
+  CHECK(in.tdi[0].currentMonthOnDuration == 3600000UL);
+}
+
+static void testDamagedSlot(void) {
+
+  // The first checkpoint goes to slot 0, the second to slot 1
+  runAndSave();
+  runAndSaveAgain();
+
+  // The last byte of the second record of slot 1, so that the first record was already applied
+  int address = slotAddress(1) + sizeof(TdioCheckpointHeader) + 2 * sizeof(TdioCheckpointRecord) - 1;
+  EEPROM.write(address, EEPROM.read(address) ^ 0x01);
+
+  CHECK(restart(15, 11, 2017) == 2);
+  CHECK(in.tdi[0].todayOnDuration == 3600000UL);
+  CHECK(in.tdi[0].currentMonthOnDuration == 3600000UL);
+
+  // Both slots damaged: the counters start from the monthly blocks
+  address = slotAddress(0) + sizeof(TdioCheckpointHeader);
+  EEPROM.write(address, EEPROM.read(address) ^ 0x01);
+  CHECK(restart(15, 11, 2017) == 0);
+  CHECK(in.tdi[0].todayOnDuration == 0);
+  CHECK(in.tdi[0].currentMonthOnDuration == 0);
+}
+
+// A periodic write of the monthly block after the last checkpoint
+static void testNewerMonthlyBlock(void) {
+
+  runAndSave();
+  EEPROM.put(EEPROM_OFFSET + (11 - 1) * sizeof(uint32_t), (uint32_t)(12 * 3600000UL));
+  CHECK(restart(16, 11, 2017) == 2);
+  CHECK(in.tdi[0].currentMonthOnDuration == 12 * 3600000UL);
+
+  // The same with begin() of each sensor and restoreCheckpoint()
+  for (uint8_t i = 0; i < 2; i++)
+    CHECK(in.tdi[i].begin(table[i].name, table[i].pin, table[i].logic, table[i].pullup, table[i].eepromBlock) == 0);
+  CHECK(in.restoreCheckpoint() == 2);
+  CHECK(in.tdi[0].currentMonthOnDuration == 12 * 3600000UL);
+}
+
+static void putMonthly(uint8_t eepromBlock, uint8_t month, uint32_t value) {
+
+  EEPROM.put(EEPROM_OFFSET + (eepromBlock * 12 + month - 1) * sizeof(uint32_t), value);
+}
+
+// The power was off at the change to December, so the block of December was never zeroed
+static void testStaleMonthlyBlock(void) {
+
+  runAndSave();
+  putMonthly(0, 12, 100 * 3600000UL);
+  CHECK(restart(5, 12, 2017) == 2);
+  CHECK(in.tdi[0].currentMonthOnDuration == 0);
+  CHECK(monthlyValue(0, 11) == 3600000UL);
+
+  for (uint8_t i = 0; i < 2; i++)
+    CHECK(in.tdi[i].begin(table[i].name, table[i].pin, table[i].logic, table[i].pullup, table[i].eepromBlock) == 0);
+  CHECK(in.restoreCheckpoint() == 2);
+  CHECK(in.tdi[0].currentMonthOnDuration == 0);
+}
+
+// The power failed while the block was zeroed, and left the high bytes of last year
+static void testTornMonthlyBlock(void) {
+
+  runAndSave();
+  putMonthly(0, 11, 0x0A000000UL);
+  CHECK(restart(16, 11, 2017) == 2);
+  CHECK(in.tdi[0].currentMonthOnDuration == 3600000UL);
+
+  // Without a checkpoint, the month total is never longer than the month so far
+  hostReset();
+  putMonthly(0, 11, 0x7F000000UL);
+  CHECK(in.begin(table, 2) == 0);
+  CHECK(in.tdi[0].currentMonthOnDuration == (14 * 24 + 12) * 3600000UL);
+}
+
+int main(void) {
+
+  // Same day
+  runAndSave();
+  CHECK(restart(15, 11, 2017) == 2);
+  CHECK(in.tdi[0].todayOnDuration == 3600000UL);
+  CHECK(in.tdi[0].currentMonthOnDuration == 3600000UL);
+
+  // Next day of the same month
+  runAndSave();
+  CHECK(restart(16, 11, 2017) == 2);
+  CHECK(in.tdi[0].todayOnDuration == 0);
+  CHECK(in.tdi[0].currentMonthOnDuration == 3600000UL);
+
+  // Next month: November closed during the outage
+  runAndSave();
+  CHECK(restart(2, 12, 2017) == 2);
+  CHECK(in.tdi[0].currentMonthOnDuration == 0);
+  CHECK(monthlyValue(0, 11) == 3600000UL);
+
+  // The same month a year later: the checkpoint is a year old
+  runAndSave();
+  CHECK(restart(20, 11, 2018) == 0);
+  CHECK(in.tdi[0].todayOnDuration == 0);
+  CHECK(in.tdi[0].currentMonthOnDuration == 0);
+
+  // Eleven months later, October 2018: November 2017 is still in the monthly block
+  runAndSave();
+  CHECK(restart(20, 10, 2018) == 2);
+  CHECK(in.tdi[0].currentMonthOnDuration == 0);
+  CHECK(monthlyValue(0, 11) == 3600000UL);
+
+  testColdStartReads();
+  testDamagedSlot();
+  testNewerMonthlyBlock();
+  testStaleMonthlyBlock();
+  testTornMonthlyBlock();
+
+  printf("ok\n");
+  return 0;
+}
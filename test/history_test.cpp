@@ -0,0 +1,186 @@
+/*
+  Test of the compressed history log of InputSensorArray
+    - once all pages are in use, the oldest page is dropped and the log goes on
+    - every record that is kept decodes to its absolute total, also the first of a page
+    - a page whose start was cut by a power failure is not in use, and the log goes on
+    - the energy of a month is logged with its duration, also for a month that closed
+      while the power was off
+*/
+#include <stdio.h>
+#include <map>
+
+#include "HostShim.h"
+#include "TimedDigitalIO.h"
+#include "check.h"
+
+#define SENSORS 4
+#define MONTHS 48
+#define RATED_POWER 2000
+
+static InputSensorArray in;
+
+static const TdiDescriptor table[SENSORS] = {
+  {"Pump",   8, TDIO_LOGIC_POSITIVE, false, 0},
+  {"Heater", 9, TDIO_LOGIC_POSITIVE, false, 1},
+  {"Fan",   10, TDIO_LOGIC_POSITIVE, false, 2},
+  {"Lamp",  11, TDIO_LOGIC_POSITIVE, false, 3}
+};
+
+// Expected totals by (year * 12 + month - 1) * SENSORS + eepromBlock
+static std::map<uint32_t, uint32_t> expected;
+static std::map<uint32_t, uint32_t> expectedEnergy;
+static std::map<uint32_t, uint32_t> decoded;
+static std::map<uint32_t, uint32_t> decodedEnergy;
+static uint32_t newestKey;
+
+static uint32_t key(uint16_t year, uint8_t month, uint8_t eepromBlock) {
+
+  return ((uint32_t)year * 12 + month - 1) * SENSORS + eepromBlock;
+}
+
+static void collect(const TdioHistoryEntry *entry) {
+
+  uint32_t k = key(entry->year, entry->month, entry->eepromBlock);
+  CHECK(entry->day == 0);
+  CHECK(decoded.find(k) == decoded.end());
+  decoded[k] = entry->onDuration;
+  decodedEnergy[k] = entry->energy;
+}
+
+// Every record decoded is the total of its month, and the records of the newest months are all there
+static void checkDecoded(uint32_t newestMonths) {
+
+  decoded.clear();
+  int count = in.readHistory(collect);
+  CHECK(count == (int)decoded.size());
+  for (std::map<uint32_t, uint32_t>::iterator it = decoded.begin(); it != decoded.end(); ++it) {
+    CHECK(expected.find(it->first) != expected.end());
+    CHECK(it->second == expected[it->first]);
+    CHECK(decodedEnergy[it->first] == expectedEnergy[it->first]);
+  }
+  for (uint32_t k = newestKey + 1 - newestMonths * SENSORS; k <= newestKey; k++)
+    CHECK(decoded.find(k) != decoded.end());
+}
+
+// A month with different on-durations, in whole minutes, then the change to the next month
+static void runMonth(uint16_t thisYear, uint8_t thisMonth, uint8_t n) {
+
+  setTime(12, 0, 0, 10, thisMonth, thisYear);
+  in.readSensors();
+  for (uint8_t i = 0; i < SENSORS; i++) {
+    uint32_t onMillis = ((n * 37 + i * 101) % 500 + 1) * 60000UL;
+    hostSetPin(table[i].pin, HIGH);
+    in.readSensors();
+    hostAdvanceMillis(onMillis);
+    in.readSensors();
+    hostSetPin(table[i].pin, LOW);
+    in.readSensors();
+    expected[key(thisYear, thisMonth, table[i].eepromBlock)] = onMillis;
+    newestKey = key(thisYear, thisMonth, table[i].eepromBlock);
+  }
+  for (uint8_t i = 0; i < SENSORS; i++)
+    expectedEnergy[key(thisYear, thisMonth, table[i].eepromBlock)] = in.tdi[i].currentMonthEnergy;
+  if (thisMonth == 12)
+    setTime(0, 0, 30, 1, 1, thisYear + 1);
+  else
+    setTime(0, 0, 30, 1, thisMonth + 1, thisYear);
+  in.readSensors();
+}
+
+static void testRing(void) {
+
+  uint16_t thisYear = 2017;
+  uint8_t thisMonth = 11;
+  for (uint8_t n = 0; n < MONTHS; n++) {
+    runMonth(thisYear, thisMonth, n);
+    if (++thisMonth > 12) {
+      thisMonth = 1;
+      ++thisYear;
+    }
+  }
+
+  // The log went round and dropped its oldest months, but still keeps more than a year
+  CHECK(in.historyWrapped);
+  CHECK(in.historyUsed() > TDIO_HISTORY_SIZE - TDIO_HISTORY_PAGE);
+  checkDecoded(18);
+  CHECK(decoded.find(key(2017, 11, 0)) == decoded.end());
+  CHECK(decoded.size() < expected.size());
+
+  // After a restart, the log is read back from the EEPROM
+  CHECK(in.begin(table, SENSORS) >= 0);
+  CHECK(in.openHistory() == (int)decoded.size());
+  checkDecoded(18);
+}
+
+static void testCutPage(void) {
+
+  // The power failed after the sequence number of the oldest page was cleared
+  uint8_t newest = 0;
+  for (uint8_t page = 0; page < TDIO_HISTORY_PAGES; page++) {
+    uint8_t sequence = EEPROM.read(TDIO_HISTORY_OFFSET + page * TDIO_HISTORY_PAGE);
+    uint8_t next = EEPROM.read(TDIO_HISTORY_OFFSET + ((page + 1) % TDIO_HISTORY_PAGES) * TDIO_HISTORY_PAGE);
+    if (next != (sequence + 1) % TDIO_HISTORY_END)
+      newest = page;
+  }
+  EEPROM.write(TDIO_HISTORY_OFFSET + ((newest + 1) % TDIO_HISTORY_PAGES) * TDIO_HISTORY_PAGE, TDIO_HISTORY_END);
+  CHECK(in.begin(table, SENSORS) >= 0);
+  in.openHistory();
+  checkDecoded(12);
+
+  // The log goes on in the page that is not in use
+  uint16_t thisYear = year(now());
+  uint8_t thisMonth = month(now());
+  for (uint8_t n = 0; n < 12; n++) {
+    runMonth(thisYear, thisMonth, n + 100);
+    if (++thisMonth > 12) {
+      thisMonth = 1;
+      ++thisYear;
+    }
+  }
+  checkDecoded(18);
+}
+
+static void testClosedWhileOff(void) {
+
+  hostReset();
+  CHECK(in.begin(table, SENSORS) == 0);
+  in.tdi[0].ratedPower = RATED_POWER;
+  hostSetPin(table[0].pin, HIGH);
+  in.readSensors();
+  hostAdvanceMillis(3600000UL);
+  in.readSensors();
+  CHECK(in.tdi[0].currentMonthEnergy == RATED_POWER);
+  CHECK(in.saveCheckpoint() == 0);
+  CHECK(in.openHistory() == 0);
+
+  // The power failed in November and came back in December
+  hostSetPin(table[0].pin, LOW);
+  setTime(12, 0, 0, 3, 12, 2017);
+  CHECK(in.begin(table, SENSORS) == SENSORS);
+  decoded.clear();
+  CHECK(in.readHistory(collect) == SENSORS);
+  CHECK(decoded[key(2017, 11, 0)] == 3600000UL);
+  CHECK(decodedEnergy[key(2017, 11, 0)] == RATED_POWER);
+  CHECK(decodedEnergy[key(2017, 11, 1)] == 0);
+
+  // A second restart from the same checkpoint does not log the month again
+  CHECK(in.begin(table, SENSORS) == SENSORS);
+  CHECK(in.openHistory() == SENSORS);
+}
+
+int main(void) {
+
+  hostReset();
+  CHECK(in.begin(table, SENSORS) == 0);
+  CHECK(in.clearHistory() == 0);
+  CHECK(in.historyUsed() == 0);
+  in.tdi[0].ratedPower = RATED_POWER;
+  in.tdi[2].ratedPower = 150;
+
+  testRing();
+  testCutPage();
+  testClosedWhileOff();
+
+  printf("ok\n");
+  return 0;
+}
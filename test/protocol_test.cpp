@@ -0,0 +1,197 @@
+/*
+  Test of TdioProtocol on a simulated serial port (HostSerial) with an RS-485 transceiver.
+    - a reply keeps the transmitter enabled until its last byte is out, without poll() waiting
+    - a late poll() does not discard a frame whose bytes are already in the receive buffer
+    - a frame that stopped arriving is discarded
+    - outputs that are not registered are rejected
+    - a reset of the counters is replied before any EEPROM write, which the array performs later
+*/
+#include <stdio.h>
+
+#include "HostShim.h"
+#include "TimedDigitalIO.h"
+#include "check.h"
+
+#define ADDRESS 7
+#define TX_ENABLE_PIN 3
+#define BAUD 115200
+
+static InputSensorArray in;
+static OutputSensorArray out;
+static TdioProtocol protocol;
+
+static const TdiDescriptor table[] = {{"Pump", 8, TDIO_LOGIC_POSITIVE, false, 0}};
+
+//--------------------------------------------------------
+// Request frame in frame[], returns its length
+static uint8_t request(uint8_t *frame, uint8_t command, const uint8_t *payload, uint8_t length) {
+
+  frame[0] = TDIO_PROTOCOL_START;
+  frame[1] = ADDRESS;
+  frame[2] = command;
+  frame[3] = length;
+  memcpy(frame + 4, payload, length);
+  uint16_t crc = tdioCrc16(0xFFFF, frame + 1, length + 3);
+  frame[4 + length] = crc & 0xFF;
+  frame[5 + length] = crc >> 8;
+  return length + 6;
+}
+
+// Status of the last reply written, or -1 if there is none
+static int replyStatus(HostSerial &port, uint8_t command) {
+
+  const std::vector<uint8_t> &w = port.written();
+  if (w.size() < 7 || w[0] != TDIO_PROTOCOL_START || w[1] != ADDRESS || w[2] != (command | TDIO_CMD_REPLY))
+    return -1;
+  CHECK(w.size() == (size_t)w[3] + 6);
+  uint16_t crc = tdioCrc16(0xFFFF, w.data() + 1, w[3] + 3);
+  CHECK(w[w.size() - 2] == (crc & 0xFF) && w[w.size() - 1] == (crc >> 8));
+  return w[4];
+}
+
+//--------------------------------------------------------
+static void testTransmitter(HostSerial &port) {
+
+  uint8_t frame[TDIO_PROTOCOL_MAX_PAYLOAD + 6];
+  uint8_t slot[2] = {0, 0};
+  port.receive(frame, request(frame, TDIO_CMD_GET_SENSOR, slot, 2));
+
+  uint64_t start = micros();
+  protocol.poll();
+  // poll() returns at once, with the reply still to be sent
+  CHECK(micros() == start);
+  CHECK(replyStatus(port, TDIO_CMD_GET_SENSOR) == TDIO_STATUS_OK);
+  CHECK(hostPin(TX_ENABLE_PIN) == HIGH);
+
+  // The transmitter is never disabled before the line is idle, and is disabled soon after
+  uint32_t frameMicros = port.written().size() * 10000000UL / BAUD;
+  while (hostPin(TX_ENABLE_PIN) == HIGH) {
+    CHECK(micros() - start <= frameMicros + 200);
+    hostAdvanceMicros(10);
+    protocol.poll();
+  }
+  CHECK(port.idle());
+  port.clearWritten();
+}
+
+//--------------------------------------------------------
+// Lets the reply go out, until poll() disables the transmitter
+static void finishReply(HostSerial &port) {
+
+  for (uint16_t i = 0; i < 1000 && hostPin(TX_ENABLE_PIN) == HIGH; i++) {
+    hostAdvanceMicros(10);
+    protocol.poll();
+  }
+  CHECK(hostPin(TX_ENABLE_PIN) == LOW);
+  port.clearWritten();
+}
+
+//--------------------------------------------------------
+static void testTimeout(HostSerial &port) {
+
+  uint8_t frame[TDIO_PROTOCOL_MAX_PAYLOAD + 6];
+  uint8_t slot[2] = {0, 0};
+  uint8_t length = request(frame, TDIO_CMD_GET_SENSOR, slot, 2);
+
+  // The whole frame arrived while loop() was busy for longer than the timeout
+  uint32_t received = protocol.framesReceived;
+  uint32_t rejected = protocol.framesRejected;
+  port.receive(frame, 3);
+  protocol.poll();
+  port.receive(frame + 3, length - 3);
+  hostAdvanceMillis(TDIO_PROTOCOL_TIMEOUT * 3);
+  protocol.poll();
+  CHECK(protocol.framesReceived == received + 1);
+  CHECK(protocol.framesRejected == rejected);
+  finishReply(port);
+
+  // Half a frame, and nothing more
+  port.receive(frame, 3);
+  protocol.poll();
+  hostAdvanceMillis(TDIO_PROTOCOL_TIMEOUT + 1);
+  protocol.poll();
+  CHECK(protocol.framesRejected == rejected + 1);
+
+  // The next frame is parsed from its start
+  port.receive(frame, length);
+  protocol.poll();
+  CHECK(protocol.framesReceived == received + 2);
+  CHECK(replyStatus(port, TDIO_CMD_GET_SENSOR) == TDIO_STATUS_OK);
+  finishReply(port);
+}
+
+//--------------------------------------------------------
+static void testOutputs(HostSerial &port) {
+
+  uint8_t frame[TDIO_PROTOCOL_MAX_PAYLOAD + 6];
+  uint8_t payload[6] = {0, 0, 0, 0, 0, 0};
+
+  // Slot 0 is registered, slot 1 is within tdo[] but not registered
+  for (uint8_t slot = 0; slot < 2; slot++) {
+    payload[0] = slot;
+    port.receive(frame, request(frame, TDIO_CMD_SET_ON, payload, 6));
+    protocol.poll();
+    CHECK(replyStatus(port, TDIO_CMD_SET_ON) == (slot == 0 ? TDIO_STATUS_OK : TDIO_STATUS_BAD_ARGUMENT));
+    CHECK(out.tdo[slot].sensorState == (slot == 0 ? TDIO_STATE_ON : TDIO_STATE_OFF));
+    finishReply(port);
+
+    port.receive(frame, request(frame, TDIO_CMD_SET_OFF, payload, 2));
+    protocol.poll();
+    CHECK(replyStatus(port, TDIO_CMD_SET_OFF) == (slot == 0 ? TDIO_STATUS_OK : TDIO_STATUS_BAD_ARGUMENT));
+    finishReply(port);
+  }
+  CHECK(out.tdo[0].sensorState == TDIO_STATE_OFF);
+}
+
+//--------------------------------------------------------
+static void testResetCounters(HostSerial &port) {
+
+  uint8_t frame[TDIO_PROTOCOL_MAX_PAYLOAD + 6];
+  uint8_t slot[2] = {TDIO_ALL_SENSORS & 0xFF, TDIO_ALL_SENSORS >> 8};
+
+  // An hour ON, recorded in a checkpoint
+  hostSetPin(8, HIGH);
+  in.readSensors();
+  hostAdvanceMillis(3600000UL);
+  in.readSensors();
+  hostSetPin(8, LOW);
+  in.readSensors();
+  CHECK(in.saveCheckpoint() == 0);
+
+  uint32_t bytesWritten = EEPROM.bytesWritten;
+  port.receive(frame, request(frame, TDIO_CMD_RESET_COUNTERS, slot, 2));
+  protocol.poll();
+  CHECK(replyStatus(port, TDIO_CMD_RESET_COUNTERS) == TDIO_STATUS_OK);
+  CHECK(EEPROM.bytesWritten == bytesWritten);
+  CHECK(in.tdi[0].currentMonthOnDuration == 0);
+  finishReply(port);
+
+  // The next pass of the array writes the monthly block and the checkpoint
+  hostAdvanceMillis(1);
+  in.readSensors();
+  CHECK(EEPROM.bytesWritten > bytesWritten);
+  uint32_t monthly;
+  EEPROM.get(EEPROM_OFFSET + (in.tdi[0].currentMonth - 1) * sizeof(uint32_t), monthly);
+  CHECK(monthly == 0);
+  CHECK(in.begin(table, 1) == 1);
+  CHECK(in.tdi[0].currentMonthOnDuration == 0);
+}
+
+int main(void) {
+
+  hostReset();
+  HostSerial port(BAUD);
+
+  CHECK(in.begin(table, 1) >= 0);
+  CHECK(out.add("Valve", 4, TDIO_LOGIC_POSITIVE) == &out.tdo[0]);
+  protocol.begin(port, ADDRESS, &in, &out, TX_ENABLE_PIN, BAUD);
+  CHECK(hostPinMode(TX_ENABLE_PIN) == OUTPUT && hostPin(TX_ENABLE_PIN) == LOW);
+
+  testTransmitter(port);
+  testTimeout(port);
+  testOutputs(port);
+  testResetCounters(port);
+
+  printf("ok\n");
+  return 0;
+}
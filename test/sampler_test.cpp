@@ -0,0 +1,117 @@
+/*
+  Concurrency test of the split between sampling and accounting (TDIO_SAMPLER).
+
+  A sampler thread moves the clock by 1 ms, changes the pins and calls captureSensors(),
+  as the sampling core of an ESP32 or RP2040 would. The main thread calls accountSensors()
+  in a loop, with slow work in between, as loop() on the other core.
+  The sampler keeps its own totals of what it produced. At the end, the ON time,
+  the number of activations and the energy of every sensor must match them exactly.
+*/
+#include <stdio.h>
+#include <thread>
+#include <atomic>
+#include <chrono>
+
+#include "HostShim.h"
+#include "TimedDigitalIO.h"
+#include "check.h"
+
+#if !TDIO_SAMPLER
+  #error "Compile the test with -DTDIO_SAMPLER=1"
+#endif
+
+#define SENSORS TDI_MAX_SENSORS
+#define CAPTURES 500000UL
+#define FIRST_PIN 2
+
+// Rated power of the sensors with energy accounting, in watts
+#define RATED_POWER 3000
+
+static InputSensorArray in;
+
+// Totals of the sampler, written by its thread only
+static uint32_t expectedOnMillis[SENSORS];
+static uint32_t expectedOnEdges[SENSORS];
+
+//--------------------------------------------------------
+static void sampler(void) {
+
+  uint32_t lfsr = 0xACE1u;
+  boolean on[SENSORS] = {false};
+
+  for (uint32_t capture = 0; capture < CAPTURES; capture++) {
+    for (uint16_t i = 0; i < SENSORS; i++) {
+      // The millisecond before the capture counts as ON if the sensor was ON at the previous capture
+      if (on[i])
+        ++expectedOnMillis[i];
+      // Each sensor changes with a probability of 1/4 to 1/32 per capture
+      lfsr = lfsr * 1103515245u + 12345u;
+      uint8_t rarity = 2 + i % 4;
+      if (((lfsr >> 8) & ((1u << rarity) - 1)) == 0) {
+        on[i] = !on[i];
+        if (on[i])
+          ++expectedOnEdges[i];
+      }
+      uint8_t logic = in.tdi[i].sensorLogic;
+      hostSetPin(FIRST_PIN + i, (on[i] == (logic == TDIO_LOGIC_POSITIVE)) ? HIGH : LOW);
+    }
+    hostAdvanceMillis(1);
+    in.captureSensors();
+  }
+}
+
+int main(void) {
+
+  hostReset();
+
+  static TdiDescriptor table[SENSORS];
+  for (uint16_t i = 0; i < SENSORS; i++) {
+    table[i].name = "Sensor";
+    table[i].pin = FIRST_PIN + i;
+    table[i].logic = (i % 2) ? TDIO_LOGIC_NEGATIVE : TDIO_LOGIC_POSITIVE;
+    table[i].pullup = false;
+    table[i].eepromBlock = i;
+    // Pins of negative logic sensors rest HIGH
+    hostSetPin(FIRST_PIN + i, table[i].logic == TDIO_LOGIC_NEGATIVE ? HIGH : LOW);
+  }
+  CHECK(in.begin(table, SENSORS) >= 0);
+  for (uint16_t i = 0; i < SENSORS; i += 3)
+    in.tdi[i].ratedPower = RATED_POWER;
+
+  std::atomic<bool> done(false);
+  std::thread samplerThread([&done] { sampler(); done = true; });
+
+  // Accounting, with slow work in between: EEPROM checkpoints and pauses
+  uint32_t passes = 0;
+  uint32_t busy = 0;
+  while (!done) {
+    if (in.accountSensors() != 0)
+      ++busy;
+    ++passes;
+    if (passes % 64 == 0)
+      in.saveCheckpoint();
+    if (passes % 256 == 0)
+      std::this_thread::sleep_for(std::chrono::microseconds(200));
+  }
+  samplerThread.join();
+  CHECK(in.accountSensors() == 0);
+
+  printf("accounting passes %u, gave up waiting %u\n", passes, busy);
+  // The accounting must have run while the sampler was running
+  CHECK(passes > 1);
+
+  for (uint16_t i = 0; i < SENSORS; i++) {
+    TimedDigitalInput *s = &in.tdi[i];
+    if (s->todayOnDuration != expectedOnMillis[i] || s->todayOnCounter != expectedOnEdges[i])
+      printf("sensor %u: on %u expected %u, activations %u expected %u\n", i,
+             s->todayOnDuration, expectedOnMillis[i], s->todayOnCounter, expectedOnEdges[i]);
+    CHECK(s->todayOnDuration == expectedOnMillis[i]);
+    CHECK(s->currentMonthOnDuration == expectedOnMillis[i]);
+    CHECK(s->todayOnCounter == expectedOnEdges[i]);
+    if (s->ratedPower > 0)
+      CHECK(s->todayEnergy == (uint64_t)expectedOnMillis[i] * RATED_POWER / TDIO_WMS_PER_WH);
+  }
+
+  printf("ok\n");
+  return 0;
+}
@@ -0,0 +1,69 @@
+/*
+  Test of reduced sampling (setPriority()) of InputSensorArray
+    - a slow sensor accumulates the same ON time as a fast sensor on the same pin trace,
+      within the averaging of the edge errors
+    - a fast sensor accumulates the exact ON time
+*/
+#include <stdio.h>
+
+#include "HostShim.h"
+#include "TimedDigitalIO.h"
+#include "check.h"
+
+// 2 s ON, then 10 to 11 s OFF, so that the ON edges fall on every
+// phase of the sampling period of the slow sensor
+#define PULSE_MILLIS 2000UL
+#define OFF_MILLIS 10000UL
+#define RUN_MILLIS 600000UL
+
+static InputSensorArray in;
+
+static const TdiDescriptor table[] = {
+  {"Fast", 8, TDIO_LOGIC_POSITIVE, false, 0},
+  {"Slow", 9, TDIO_LOGIC_POSITIVE, false, 1}
+};
+
+static uint8_t pulses(uint8_t pin, uint32_t millis) {
+
+  (void)pin;
+  uint32_t start = 0;
+  for (uint32_t n = 0; ; n++) {
+    start += OFF_MILLIS + (n * 389) % 1000;
+    if (millis < start)
+      return LOW;
+    if (millis < start + PULSE_MILLIS)
+      return HIGH;
+    start += PULSE_MILLIS;
+  }
+}
+
+int main(void) {
+
+  hostReset();
+  CHECK(in.begin(table, 2) == 0);
+  in.tdi[1].setPriority(TDIO_PRIORITY_SLOW);
+  hostSetPinTrace(pulses);
+
+  // The loop reads the sensors every millisecond
+  uint32_t expected = 0;
+  for (uint32_t t = 1; t <= RUN_MILLIS; t++) {
+    if (pulses(8, t - 1) == HIGH)
+      ++expected;
+    hostAdvanceMillis(1);
+    in.readSensors();
+  }
+
+  uint32_t fast = in.tdi[0].todayOnDuration;
+  uint32_t slow = in.tdi[1].todayOnDuration;
+  printf("expected %u, fast %u, slow %u\n", expected, fast, slow);
+  CHECK(in.tdi[0].todayOnCounter == in.tdi[1].todayOnCounter);
+  CHECK(fast + 1 >= expected && fast <= expected + 1);
+  // Each activation of the slow sensor is off by at most half its sampling period
+  CHECK(slow + in.tdi[1].todayOnCounter * TDIO_PERIOD_SLOW / 2 >= fast);
+  CHECK(slow <= fast + in.tdi[1].todayOnCounter * TDIO_PERIOD_SLOW / 2);
+  // and the errors average out
+  CHECK(slow * 100 >= fast * 97 && slow * 100 <= fast * 103);
+
+  printf("ok\n");
+  return 0;
+}
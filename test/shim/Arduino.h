@@ -0,0 +1,100 @@
+/*
+  Host stand-in for the Arduino core, used to build TimedDigitalIO on Linux
+  for the benchmark and the tests under test/. Only what the library uses is provided.
+
+  The clock does not run by itself. It is moved by the program with hostAdvanceMillis(),
+  so a simulated day takes as long as the work done during it. See HostShim.h.
+*/
+#ifndef TDIO_HOST_ARDUINO_H
+#define TDIO_HOST_ARDUINO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdlib.h>
+#include <type_traits>
+
+typedef bool boolean;
+typedef uint8_t byte;
+
+#define HIGH 1
+#define LOW 0
+
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+
+#define DEC 10
+#define HEX 16
+
+// Strings are not moved to flash on the host
+#define F(string) (string)
+
+unsigned long millis(void);
+unsigned long micros(void);
+void delay(unsigned long ms);
+int digitalRead(uint8_t pin);
+void digitalWrite(uint8_t pin, uint8_t value);
+void pinMode(uint8_t pin, uint8_t mode);
+void noInterrupts(void);
+void interrupts(void);
+
+//--------------------------------------------------------
+// Formatted output, as the Print class of the Arduino core
+class Print {
+
+  private:
+    size_t printNumber(unsigned long long n, int base, boolean negative);
+
+  public:
+    virtual ~Print() {}
+    virtual size_t write(uint8_t value) = 0;
+    virtual size_t write(const uint8_t *buffer, size_t size);
+    virtual int availableForWrite(void) { return 0; }
+    virtual void flush(void) {}
+
+    size_t write(const char *s) { return write((const uint8_t *)s, strlen(s)); }
+
+    size_t print(const char *s) { return write(s); }
+    size_t print(char c) { return write((uint8_t)c); }
+    template <typename T>
+    typename std::enable_if<std::is_integral<T>::value, size_t>::type print(T n, int base = DEC) {
+      if (std::is_signed<T>::value && n < 0)
+        return printNumber(0ULL - (unsigned long long)n, base, true);
+      return printNumber((unsigned long long)n, base, false);
+    }
+    size_t print(double n, int digits = 2);
+
+    size_t println(void) { return write("\r\n"); }
+    template <typename T>
+    size_t println(T value) { size_t n = print(value); return n + println(); }
+    template <typename T>
+    size_t println(T value, int format) { size_t n = print(value, format); return n + println(); }
+};
+
+//--------------------------------------------------------
+class Stream : public Print {
+
+  public:
+    virtual int available(void) = 0;
+    virtual int read(void) = 0;
+    virtual int peek(void) = 0;
+};
+
+//--------------------------------------------------------
+// Serial writes to stdout and never receives anything
+class HardwareSerial : public Stream {
+
+  public:
+    void begin(unsigned long baud) { (void)baud; }
+    operator bool() { return true; }
+    size_t write(uint8_t value);
+    using Print::write;
+    int available(void) { return 0; }
+    int read(void) { return -1; }
+    int peek(void) { return -1; }
+};
+
+extern HardwareSerial Serial;
+
+#endif // TDIO_HOST_ARDUINO_H
@@ -0,0 +1,7 @@
+// Host stand-in for the DS1307RTC library. The clock of the shim replaces the RTC
+#ifndef TDIO_HOST_DS1307RTC_H
+#define TDIO_HOST_DS1307RTC_H
+
+#include "TimeLib.h"
+
+#endif
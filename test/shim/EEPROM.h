@@ -0,0 +1,65 @@
+/*
+  Host stand-in for the EEPROM library. The memory starts erased (0xFF).
+  As on the AVR, put() writes only the bytes that change. The shim counts
+  the bytes read and the bytes really written, see HostShim.h.
+*/
+#ifndef TDIO_HOST_EEPROM_H
+#define TDIO_HOST_EEPROM_H
+
+#include "Arduino.h"
+
+// Large enough for the layout of 1024 sensors
+#ifndef HOST_EEPROM_SIZE
+#define HOST_EEPROM_SIZE 131072
+#endif
+
+class EEPROMClass {
+
+  public:
+    uint8_t data[HOST_EEPROM_SIZE];
+    // Bytes read, and bytes written with a value different from the previous one
+    uint32_t bytesRead = 0;
+    uint32_t bytesWritten = 0;
+
+    EEPROMClass(void) { erase(); }
+
+    void erase(void) { memset(data, 0xFF, sizeof(data)); }
+
+    // begin() and commit() of the boards that emulate the EEPROM in flash
+    void begin(size_t size) { (void)size; }
+    boolean commit(void) { return true; }
+    uint16_t length(void) { return HOST_EEPROM_SIZE > 0xFFFF ? 0xFFFF : HOST_EEPROM_SIZE; }
+
+    uint8_t read(int address) {
+      ++bytesRead;
+      return data[address];
+    }
+
+    void write(int address, uint8_t value) {
+      data[address] = value;
+      ++bytesWritten;
+    }
+
+    void update(int address, uint8_t value) {
+      if (data[address] != value)
+        write(address, value);
+    }
+
+    template <typename T> T &get(int address, T &t) {
+      uint8_t *p = (uint8_t *)&t;
+      for (size_t i = 0; i < sizeof(T); i++)
+        p[i] = read(address + i);
+      return t;
+    }
+
+    template <typename T> const T &put(int address, const T &t) {
+      const uint8_t *p = (const uint8_t *)&t;
+      for (size_t i = 0; i < sizeof(T); i++)
+        update(address + i, p[i]);
+      return t;
+    }
+};
+
+extern EEPROMClass EEPROM;
+
+#endif // TDIO_HOST_EEPROM_H
@@ -0,0 +1,254 @@
+/*
+  Host stand-in for the Arduino core, the EEPROM and the Time library.
+  See HostShim.h.
+*/
+#include <stdio.h>
+#include <atomic>
+
+#include "HostShim.h"
+
+HardwareSerial Serial;
+EEPROMClass EEPROM;
+
+// The clock in micros, and the unix time at micros 0
+static std::atomic<uint64_t> clockMicros(0);
+static std::atomic<int64_t> timeBase(0);
+
+static std::atomic<uint8_t> pins[256];
+static uint8_t modes[256];
+static std::atomic<HostPinTrace> pinTrace(nullptr);
+
+//--------------------------------------------------------
+void hostReset(void) {
+
+  clockMicros = 0;
+  pinTrace = nullptr;
+  for (int i = 0; i < 256; i++) {
+    pins[i] = LOW;
+    modes[i] = INPUT;
+  }
+  EEPROM.erase();
+  EEPROM.bytesRead = 0;
+  EEPROM.bytesWritten = 0;
+  setTime(12, 0, 0, 15, 11, 2017);
+}
+
+void hostAdvanceMillis(uint32_t ms) {
+
+  clockMicros += (uint64_t)ms * 1000;
+}
+
+void hostAdvanceMicros(uint32_t us) {
+
+  clockMicros += us;
+}
+
+void hostSetPin(uint8_t pin, uint8_t value) {
+
+  pins[pin] = value;
+}
+
+uint8_t hostPin(uint8_t pin) {
+
+  return pins[pin];
+}
+
+uint8_t hostPinMode(uint8_t pin) {
+
+  return modes[pin];
+}
+
+void hostSetPinTrace(HostPinTrace trace) {
+
+  pinTrace = trace;
+}
+
+//--------------------------------------------------------
+static uint64_t clockNow(void) {
+
+  return clockMicros;
+}
+
+void HostSerial::receive(const uint8_t *data, size_t size) {
+
+  _received.insert(_received.end(), data, data + size);
+}
+
+int HostSerial::read(void) {
+
+  if (_received.empty())
+    return -1;
+  uint8_t value = _received.front();
+  _received.pop_front();
+  return value;
+}
+
+size_t HostSerial::write(uint8_t value) {
+
+  uint64_t start = clockNow();
+  if (_lastOutMicros > start)
+    start = _lastOutMicros;
+  _startMicros.push_back(start);
+  _lastOutMicros = start + _byteMicros;
+  _written.push_back(value);
+  return 1;
+}
+
+int HostSerial::availableForWrite(void) {
+
+  uint64_t now = clockNow();
+  while (!_startMicros.empty() && _startMicros.front() <= now)
+    _startMicros.pop_front();
+  return HOST_SERIAL_TX_BUFFER - (int)_startMicros.size();
+}
+
+boolean HostSerial::idle(void) {
+
+  return clockNow() >= _lastOutMicros;
+}
+
+void HostSerial::flush(void) {
+
+  if (_lastOutMicros > clockNow())
+    clockMicros = _lastOutMicros;
+  _startMicros.clear();
+}
+
+////////// Arduino core /////////
+
+unsigned long millis(void) {
+
+  return (unsigned long)(uint32_t)(clockMicros / 1000);
+}
+
+unsigned long micros(void) {
+
+  return (unsigned long)(uint32_t)clockMicros;
+}
+
+void delay(unsigned long ms) {
+
+  hostAdvanceMillis(ms);
+}
+
+int digitalRead(uint8_t pin) {
+
+  HostPinTrace trace = pinTrace;
+  if (trace != nullptr)
+    return trace(pin, millis());
+  return pins[pin];
+}
+
+void digitalWrite(uint8_t pin, uint8_t value) {
+
+  pins[pin] = value;
+}
+
+void pinMode(uint8_t pin, uint8_t mode) {
+
+  modes[pin] = mode;
+}
+
+void noInterrupts(void) {
+}
+
+void interrupts(void) {
+}
+
+//--------------------------------------------------------
+size_t Print::write(const uint8_t *buffer, size_t size) {
+
+  size_t n = 0;
+  while (size--)
+    n += write(*buffer++);
+  return n;
+}
+
+size_t Print::printNumber(unsigned long long n, int base, boolean negative) {
+
+  char buffer[68];
+  char *p = buffer + sizeof(buffer) - 1;
+  *p = 0;
+  if (base < 2)
+    base = 10;
+  do {
+    int digit = n % base;
+    *--p = digit < 10 ? '0' + digit : 'A' + digit - 10;
+    n /= base;
+  } while (n > 0);
+  if (negative)
+    *--p = '-';
+  return write(p);
+}
+
+size_t Print::print(double n, int digits) {
+
+  char buffer[64];
+  snprintf(buffer, sizeof(buffer), "%.*f", digits, n);
+  return write(buffer);
+}
+
+size_t HardwareSerial::write(uint8_t value) {
+
+  return fputc(value, stdout) == EOF ? 0 : 1;
+}
+
+////////// Time library /////////
+
+time_t now(void) {
+
+  return (time_t)(timeBase + (int64_t)(clockMicros / 1000000));
+}
+
+void setTime(time_t t) {
+
+  timeBase = (int64_t)t - (int64_t)(clockMicros / 1000000);
+}
+
+void setTime(int hr, int min, int sec, int dy, int mnth, int yr) {
+
+  struct tm tm;
+  memset(&tm, 0, sizeof(tm));
+  tm.tm_year = yr - 1900;
+  tm.tm_mon = mnth - 1;
+  tm.tm_mday = dy;
+  tm.tm_hour = hr;
+  tm.tm_min = min;
+  tm.tm_sec = sec;
+  setTime(timegm(&tm));
+}
+
+void adjustTime(long adjustment) {
+
+  timeBase += adjustment;
+}
+
+void setSyncProvider(getExternalTime getTimeFunction) {
+
+  (void)getTimeFunction;
+}
+
+void setSyncInterval(time_t interval) {
+
+  (void)interval;
+}
+
+// The library asks for the day and the month of the same time on every sample,
+// so the last conversion is kept, once per thread
+static const struct tm &breakTime(time_t t) {
+
+  static thread_local time_t cachedTime = -1;
+  static thread_local struct tm cachedTm;
+  if (t != cachedTime) {
+    gmtime_r(&t, &cachedTm);
+    cachedTime = t;
+  }
+  return cachedTm;
+}
+
+int year(time_t t) { return breakTime(t).tm_year + 1900; }
+int month(time_t t) { return breakTime(t).tm_mon + 1; }
+int day(time_t t) { return breakTime(t).tm_mday; }
+int hour(time_t t) { return breakTime(t).tm_hour; }
+int minute(time_t t) { return breakTime(t).tm_min; }
+int second(time_t t) { return breakTime(t).tm_sec; }
@@ -0,0 +1,73 @@
+/*
+  Control of the host stand-in by the benchmark and the tests.
+
+  The clock, the pins and the EEPROM are simulated. The clock is moved only by
+  hostAdvanceMillis() or hostAdvanceMicros(), and can be moved from one thread
+  while another reads it. The pins are set one by one with hostSetPin(), or by
+  a trace: a function of the pin and of the time that digitalRead() calls.
+  HostSerial is a serial port that sends its bytes at the speed of the clock.
+*/
+#ifndef TDIO_HOST_SHIM_H
+#define TDIO_HOST_SHIM_H
+
+#include <deque>
+#include <vector>
+
+#include "Arduino.h"
+#include "EEPROM.h"
+#include "TimeLib.h"
+
+// Value of a pin at a given time, e.g. a square wave or a recorded sequence
+typedef uint8_t (*HostPinTrace)(uint8_t pin, uint32_t millis);
+
+// Clock to 0, pins LOW, no trace, EEPROM erased and its counters cleared,
+// date 2017-11-15 12:00:00
+void hostReset(void);
+
+void hostAdvanceMillis(uint32_t ms);
+void hostAdvanceMicros(uint32_t us);
+
+void hostSetPin(uint8_t pin, uint8_t value);
+// Last value written to a pin, by the program or by digitalWrite()
+uint8_t hostPin(uint8_t pin);
+// Mode given to a pin by pinMode()
+uint8_t hostPinMode(uint8_t pin);
+void hostSetPinTrace(HostPinTrace trace);
+
+//--------------------------------------------------------
+// A serial port with a transmit buffer of HOST_SERIAL_TX_BUFFER bytes, as on the AVR.
+// A written byte waits in the buffer until the previous one is out, then stays
+// in the shift register for 10 bit times. Not thread safe
+#define HOST_SERIAL_TX_BUFFER 64
+
+class HostSerial : public Stream {
+
+  private:
+    uint32_t _byteMicros;
+    std::deque<uint8_t> _received;
+    // Time each byte in the buffer moves to the shift register, and time the last byte is out
+    std::deque<uint64_t> _startMicros;
+    uint64_t _lastOutMicros = 0;
+    std::vector<uint8_t> _written;
+
+  public:
+    HostSerial(uint32_t baud) : _byteMicros(10000000UL / baud) {}
+    // Bytes arriving from the bus
+    void receive(const uint8_t *data, size_t size);
+    // Bytes written by the program so far, including those still in the buffer
+    const std::vector<uint8_t> &written(void) { return _written; }
+    void clearWritten(void) { _written.clear(); }
+    // True when the last byte written is completely out
+    boolean idle(void);
+
+    int available(void) { return (int)_received.size(); }
+    int read(void);
+    int peek(void) { return _received.empty() ? -1 : _received.front(); }
+    size_t write(uint8_t value);
+    using Print::write;
+    int availableForWrite(void);
+    // Moves the clock until the last byte is out, as the busy wait of the Arduino core
+    void flush(void);
+};
+
+#endif // TDIO_HOST_SHIM_H
@@ -0,0 +1,32 @@
+/*
+  Host stand-in for the Time library. now() follows the simulated clock
+  of the shim: setTime() fixes the date at the current millis(), and the date
+  then advances with hostAdvanceMillis().
+*/
+#ifndef TDIO_HOST_TIMELIB_H
+#define TDIO_HOST_TIMELIB_H
+
+#include <time.h>
+#include "Arduino.h"
+
+#define SECS_PER_MIN 60UL
+#define SECS_PER_HOUR 3600UL
+#define SECS_PER_DAY 86400UL
+
+typedef time_t (*getExternalTime)(void);
+
+time_t now(void);
+void setTime(time_t t);
+void setTime(int hr, int min, int sec, int day, int month, int yr);
+void adjustTime(long adjustment);
+void setSyncProvider(getExternalTime getTimeFunction);
+void setSyncInterval(time_t interval);
+
+int year(time_t t);
+int month(time_t t);
+int day(time_t t);
+int hour(time_t t);
+int minute(time_t t);
+int second(time_t t);
+
+#endif // TDIO_HOST_TIMELIB_H
@@ -0,0 +1,4 @@
+// Host stand-in for the Wire library. The library includes it but does not use it
+#ifndef TDIO_HOST_WIRE_H
+#define TDIO_HOST_WIRE_H
+#endif